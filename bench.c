@@ -0,0 +1,223 @@
+#include "lib_tar.h"
+#include "tar_client.h"
+#include <time.h>
+
+/**
+ * Micro-benchmarks for lib_tar
+ * Usage: ./bench tar_file member [iterations]   read_file latency with and without the content cache
+ *        ./bench --index [entries]               path index size and lookup latency on a generated archive
+ *        ./bench --daemon socket tar_file member  cost of a short-lived reader, alone or through tar_daemon
+ */
+
+static double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/**
+ * Times `iterations` reads of the whole member and returns the mean latency in nanoseconds
+ */
+static double time_reads(int fd, char *member, uint8_t *dest, size_t size, int iterations)
+{
+    double start = now_ns();
+    for (int i = 0; i < iterations; i++)
+    {
+        size_t len = size;
+        if (read_file(fd, member, 0, dest, &len) < 0)
+        {
+            printf("read_file(%s) failed\n", member);
+            exit(1);
+        }
+    }
+    return (now_ns() - start) / iterations;
+}
+
+/**
+ * Appends an empty member with a valid ustar header to the archive
+ */
+static void write_header(FILE *tar, const char *name, char typeflag)
+{
+    tar_header_t head;
+    memset(&head, 0, sizeof(tar_header_t));
+    strncpy(head.name, name, sizeof(head.name) - 1);
+    strcpy(head.mode, typeflag == DIRTYPE ? "0000755" : "0000644");
+    strcpy(head.uid, "0000000");
+    strcpy(head.gid, "0000000");
+    strcpy(head.size, "00000000000");
+    strcpy(head.mtime, "00000000000");
+    head.typeflag = typeflag;
+    memcpy(head.magic, TMAGIC, TMAGLEN);
+    memcpy(head.version, TVERSION, TVERSLEN);
+    memset(head.chksum, ' ', sizeof(head.chksum));
+    long counter = 0;
+    for (int i = 0; i < sizeof(tar_header_t); i++)
+        counter += ((char *)&head)[i];
+    sprintf(head.chksum, "%06lo", counter);
+    fwrite(&head, sizeof(tar_header_t), 1, tar);
+}
+
+/**
+ * Generates an archive of about `entries` members spread over a deep directory tree,
+ * then reports the size of its index and the latency of indexed lookups
+ */
+static int bench_index(long entries)
+{
+    char archive[] = "/tmp/lib_tar_bench_XXXXXX";
+    int fd = mkstemp(archive);
+    if (fd == -1)
+    {
+        perror("mkstemp");
+        return -1;
+    }
+    FILE *tar = fdopen(dup(fd), "w");
+    char name[100];
+    long files = 0, written = 0;
+    for (int project = 0; files < entries; project++)
+    {
+        sprintf(name, "data/projects/project%04d/", project);
+        write_header(tar, name, DIRTYPE);
+        written++;
+        for (int module = 0; module < 20 && files < entries; module++)
+        {
+            sprintf(name, "data/projects/project%04d/src/module%02d/", project, module);
+            write_header(tar, name, DIRTYPE);
+            written++;
+            for (int file = 0; file < 50 && files < entries; file++, files++)
+            {
+                sprintf(name, "data/projects/project%04d/src/module%02d/file%07ld.c", project, module, files);
+                write_header(tar, name, REGTYPE);
+                written++;
+            }
+        }
+    }
+    char end[2 * sizeof(tar_header_t)] = {0};
+    fwrite(end, sizeof(end), 1, tar);
+    fclose(tar);
+    unlink(archive);
+    // Like an archive already on disk, its pages in the cache are clean and can be reclaimed for the index
+    fdatasync(fd);
+
+    printf("\nBenchmark: path index, %ld entries\n", written);
+
+    double start = now_ns();
+    tar_index_build(fd);
+    printf("Build    : %10.1f ms\n", (now_ns() - start) / 1e6);
+
+    tar_index_stats_t stats;
+    tar_index_stats(fd, &stats);
+    printf("Size     : %zu bytes, %.1f bytes/entry (%zu nodes, %zu components)\n",
+           stats.bytes, (double)stats.bytes / stats.entries, stats.nodes, stats.components);
+    printf("Raw names: %.1f bytes/entry in tar_header_t name and prefix\n",
+           (double)(sizeof(((tar_header_t *)0)->name) + sizeof(((tar_header_t *)0)->prefix)));
+
+    // Random existing paths, formatted up front so that only the lookups are timed
+    int lookups = 100000, found = 0;
+    char (*paths)[100] = malloc(lookups * sizeof(*paths));
+    srand(42);
+    for (int i = 0; i < lookups; i++)
+    {
+        long file = rand() % files;
+        sprintf(paths[i], "data/projects/project%04ld/src/module%02ld/file%07ld.c", file / 1000, file / 50 % 20, file);
+    }
+    start = now_ns();
+    for (int i = 0; i < lookups; i++)
+        found += is_file(fd, paths[i]);
+    printf("is_file  : %10.1f ns/lookup (%d found)\n", (now_ns() - start) / lookups, found);
+    free(paths);
+
+    tar_index_free(fd);
+    close(fd);
+    return 0;
+}
+
+/**
+ * Compares what a short-lived process pays to read one member: opening the archive itself
+ * versus connecting to a daemon that already holds it
+ */
+static int bench_daemon(char *socket_path, char *archive, char *member)
+{
+    int iterations = 2000;
+    uint8_t dest[4096];
+    size_t len;
+
+    printf("\nBenchmark: open + exists + read_file(%s), %d iterations\n", member, iterations);
+
+    double start = now_ns();
+    for (int i = 0; i < iterations; i++)
+    {
+        int fd = open(archive, O_RDONLY);
+        len = sizeof(dest);
+        if (fd == -1 || !exists(fd, member) || read_file(fd, member, 0, dest, &len) < 0)
+        {
+            printf("Could not read %s from %s\n", member, archive);
+            return -1;
+        }
+        close(fd);
+    }
+    double alone = (now_ns() - start) / iterations;
+    printf("Alone    : %10.1f ns/process\n", alone);
+
+    start = now_ns();
+    for (int i = 0; i < iterations; i++)
+    {
+        int fd = tarc_open(socket_path, archive);
+        len = sizeof(dest);
+        if (fd == -1 || !tarc_exists(fd, member) || tarc_read_file(fd, member, 0, dest, &len) < 0)
+        {
+            printf("Could not read %s through %s\n", member, socket_path);
+            return -1;
+        }
+        tarc_close(fd);
+    }
+    double daemon = (now_ns() - start) / iterations;
+    printf("Daemon   : %10.1f ns/process (x%.1f)\n", daemon, alone / daemon);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc >= 2 && strcmp(argv[1], "--index") == 0)
+        return bench_index(argc > 2 ? atol(argv[2]) : 1000000);
+    if (argc >= 5 && strcmp(argv[1], "--daemon") == 0)
+        return bench_daemon(argv[2], argv[3], argv[4]);
+    if (argc < 3)
+    {
+        printf("Usage: %s tar_file member [iterations]\n", argv[0]);
+        printf("       %s --index [entries]\n", argv[0]);
+        printf("       %s --daemon socket tar_file member\n", argv[0]);
+        return -1;
+    }
+    int iterations = argc > 3 ? atoi(argv[3]) : 100000;
+
+    int fd = open(argv[1], O_RDONLY);
+    if (fd == -1)
+    {
+        perror("open(tar_file)");
+        return -1;
+    }
+
+    size_t size = 1 << 20;
+    uint8_t *dest = malloc(size);
+
+    printf("\nBenchmark: read_file(%s), %d iterations\n", argv[2], iterations);
+
+    double uncached = time_reads(fd, argv[2], dest, size, iterations);
+    printf("Uncached : %10.1f ns/read\n", uncached);
+
+    tar_cache_enable(fd, 64 << 20, 64 << 10);
+    double cached = time_reads(fd, argv[2], dest, size, iterations);
+    printf("Cached   : %10.1f ns/read (x%.1f)\n", cached, uncached / cached);
+
+    tar_cache_stats_t stats;
+    tar_cache_stats(fd, &stats);
+    printf("Hits: %llu, misses: %llu, evictions: %llu, entries: %zu, bytes: %zu\n",
+           (unsigned long long)stats.hits, (unsigned long long)stats.misses,
+           (unsigned long long)stats.evictions, stats.entries, stats.bytes);
+
+    tar_cache_disable(fd);
+    free(dest);
+    close(fd);
+    return 0;
+}
@@ -1,4 +1,5 @@
 #include "lib_tar.h"
+#include <sys/mman.h>
 
 #define PATH_SIZE 1000 
 
@@ -13,6 +14,767 @@ void print_header(tar_header_t *head)
     printf("Ending printing header ...\n\n");
 }
 
+/**
+ * Private method
+ * Checks that tar_fd still refers to the file state was attached to, the number may have been reused
+ */
+static int same_file(int tar_fd, dev_t dev, ino_t ino)
+{
+    struct stat st;
+    return fstat(tar_fd, &st) == 0 && st.st_dev == dev && st.st_ino == ino;
+}
+
+/* Flags of the path index nodes */
+#define INDEX_ENTRY 1   // the node has its own header in the archive
+#define INDEX_SLASH 2   // the header name ends with a '/'
+
+#define INDEX_MAX_DEPTH 128     // a header name of 100 characters has at most 100 components
+
+/**
+ * Path index of an archive, a trie with one node per path component.
+ *
+ * Component names are interned: each distinct name is stored once in `pool`, sorted, and nodes refer
+ * to it by its offset in the pool. The children of a node are contiguous and sorted by name, and the
+ * nodes are numbered breadth first, so the children of node i end where those of node i + 1 start.
+ *
+ * Nodes are found through `table`, an open addressing table keyed by the hash of the path of the
+ * node up to its component (e.g. "dir/sub" for the node "sub"). The slot of every level of a path is
+ * known from the path alone, so a lookup reads all of them at once instead of one level after the
+ * other. A slot holds the name of its node as well, the nodes and their names are then read at once
+ * too, to check that each node is a child of the previous one with the same component name.
+ *
+ * A path maps to exactly one list of components: it is split at every '/', an empty last piece means
+ * the path ends with a '/' and any other empty piece is an empty component. The index thus finds a
+ * header only when its name is exactly the given path, like a scan does.
+ * Node 0 is the root of the archive.
+ */
+typedef struct index_node
+{
+    uint32_t name;              // offset of the component name in pool
+    uint32_t first_child;
+    uint32_t block;             // position of the header in the archive, in 512-byte blocks
+} index_node_t;
+
+typedef struct index_meta
+{
+    uint8_t type;               // typeflag of the header
+    uint8_t flags;              // INDEX_ENTRY | INDEX_SLASH
+} index_meta_t;
+
+typedef struct index_slot
+{
+    uint32_t node;              // 0 (the root) marks an empty slot
+    uint32_t name;              // copy of the name of the node
+} index_slot_t;
+
+typedef struct tar_index
+{
+    dev_t dev;                  // identity of the archive the index was built on
+    ino_t ino;
+    char *pool;                 // NUL-terminated component names
+    index_node_t *trie;         // nodes + 1 entries, the last one only ends the children of the others
+    index_meta_t *meta;         // checked once the node of a path is found
+    index_slot_t *table;
+    size_t pool_size;
+    size_t slots;
+    uint32_t components;
+    uint32_t nodes;
+    uint32_t entries;
+    uint32_t depth;             // most components in the path of a node
+} tar_index_t;
+
+static tar_index_t *indexes[TAR_MAX_HANDLES];
+
+static tar_index_t *index_of(int tar_fd)
+{
+    if (tar_fd < 0 || tar_fd >= TAR_MAX_HANDLES)
+        return NULL;
+    return indexes[tar_fd];
+}
+
+/**
+ * Private method
+ * Hash of the path of a node from the hash of the path of its parent and its component name,
+ * read 8 bytes at a time. The root hashes to zero.
+ */
+static uint64_t index_hash(uint64_t parent, const char *s, size_t n)
+{
+    uint64_t hash = parent ^ n;
+    uint64_t word;
+    for (; n >= 8; s += 8, n -= 8)
+    {
+        memcpy(&word, s, 8);
+        hash = (hash ^ word) * 0x9E3779B97F4A7C15ull;
+        hash ^= hash >> 32;
+    }
+    word = 0;
+    for (size_t i = 0; i < n; i++)
+        word |= (uint64_t)(uint8_t)s[i] << (8 * i);
+    hash = (hash ^ word) * 0x9E3779B97F4A7C15ull;
+    return hash ^ hash >> 29;
+}
+
+/**
+ * Private method
+ * Slot of the table for the hash of a path, mapped onto the table without a division
+ */
+static size_t index_slot(tar_index_t *index, uint64_t hash)
+{
+    return (hash >> 32) * index->slots >> 32;
+}
+
+/**
+ * Private method
+ * Compares the n first characters of s with a NUL-terminated component name
+ */
+static int component_cmp(const char *s, size_t n, const char *name)
+{
+    int r = strncmp(s, name, n);
+    if (r != 0)
+        return r;
+    return name[n] == '\0' ? 0 : -1;
+}
+
+/**
+ * Private method
+ * Checks whether the node of a slot is the child of parent with the given component name
+ * Components longer than a header name never get here, and the pool is padded with as many bytes
+ */
+static int index_is_child(tar_index_t *index, uint32_t parent, index_slot_t *slot, const char *s, size_t n)
+{
+    // Children are contiguous, first_child of parent <= node < first_child of parent + 1
+    if (slot->node - index->trie[parent].first_child >= index->trie[parent + 1].first_child - index->trie[parent].first_child)
+        return 0;
+    const char *name = index->pool + slot->name;
+    return memcmp(s, name, n) == 0 && name[n] == '\0';
+}
+
+/**
+ * Private method
+ * Returns the node of the header named exactly path, or -1 if there is none
+ */
+static long index_find(tar_index_t *index, const char *path)
+{
+    const char *start[INDEX_MAX_DEPTH];
+    size_t length[INDEX_MAX_DEPTH];
+    size_t slot[INDEX_MAX_DEPTH];
+    index_slot_t candidate[INDEX_MAX_DEPTH];
+    uint64_t hash = 0;
+    uint32_t depth = 0;
+    const char *s = path;
+    const char *end;
+    // Split the path like index_add() and hash each prefix, without reading the index yet
+    while ((end = strchr(s, '/')) != NULL || *s != '\0')
+    {
+        size_t n = end ? (size_t)(end - s) : strlen(s);
+        if (depth == index->depth || n >= TAR_PATH_SIZE)
+            return -1;
+        hash = index_hash(hash, s, n);
+        start[depth] = s;
+        length[depth] = n;
+        slot[depth++] = index_slot(index, hash);
+        if (end == NULL)
+            break;
+        s = end + 1;
+    }
+    // s is empty when the path ends with a '/'
+    int slash = end == NULL && *s == '\0';
+    if (depth == 0)
+        return -1;
+
+    // The levels do not depend on each other here, so their cache misses overlap:
+    // first the slots, then the nodes and their names
+    for (uint32_t i = 0; i < depth; i++)
+        candidate[i] = index->table[slot[i]];
+    for (uint32_t i = 0; i < depth; i++)
+    {
+        // The node of the last level has no children to check, only its name and its meta
+        if (i + 1 < depth)
+        {
+            __builtin_prefetch(&index->trie[candidate[i].node]);
+            __builtin_prefetch(&index->trie[candidate[i].node + 1]);
+        }
+        __builtin_prefetch(index->pool + candidate[i].name);
+    }
+    __builtin_prefetch(&index->meta[candidate[depth - 1].node]);
+
+    uint32_t parent = 0;
+    for (uint32_t i = 0; i < depth; i++)
+    {
+        // Another prefix may own the slot, probe on until the child of parent or an empty slot
+        while (candidate[i].node != 0 && !index_is_child(index, parent, &candidate[i], start[i], length[i]))
+        {
+            slot[i] = slot[i] + 1 == index->slots ? 0 : slot[i] + 1;
+            candidate[i] = index->table[slot[i]];
+        }
+        if (candidate[i].node == 0)
+            return -1;
+        parent = candidate[i].node;
+    }
+    if (!(index->meta[parent].flags & INDEX_ENTRY) || !(index->meta[parent].flags & INDEX_SLASH) != !slash)
+        return -1;
+    return parent;
+}
+
+/**
+ * Private method
+ * Reads the header of an indexed node
+ */
+static int index_header(int tar_fd, tar_index_t *index, long node, tar_header_t *head)
+{
+    off_t position = (off_t)index->trie[node].block * sizeof(tar_header_t);
+    return pread(tar_fd, head, sizeof(tar_header_t), position) == sizeof(tar_header_t) ? 0 : -1;
+}
+
+/**
+ * Private method
+ * Allocates an array of the index, large ones on huge pages where the system allows it,
+ * a lookup then misses the TLB far less often on a big archive
+ */
+static void *index_alloc(size_t size)
+{
+    void *array = NULL;
+    size_t huge = 2 << 20;
+    if (size < huge)
+        return malloc(size ? size : 1);
+    if (posix_memalign(&array, huge, size) != 0)
+        return NULL;
+#ifdef MADV_HUGEPAGE
+    madvise(array, (size + huge - 1) / huge * huge, MADV_HUGEPAGE);
+#endif
+    return array;
+}
+
+/**
+ * Private method
+ * Grows a build array so that it can hold at least count + 1 items
+ */
+static int grow(void **array, size_t *capacity, size_t count, size_t item)
+{
+    if (count < *capacity)
+        return 0;
+    size_t wanted = *capacity ? *capacity * 2 : 1024;
+    void *bigger = realloc(*array, wanted * item);
+    if (bigger == NULL)
+        return -1;
+    *array = bigger;
+    *capacity = wanted;
+    return 0;
+}
+
+/* State used while scanning the archive, before the trie is laid out */
+typedef struct index_builder
+{
+    char *pool;
+    size_t pool_size, pool_capacity;
+    uint32_t *component;
+    size_t components, component_capacity;
+    uint32_t *component_table;      // open addressing, component id + 1
+    size_t component_table_size;
+
+    uint32_t *parent, *name, *block;
+    uint8_t *type, *flags;
+    size_t nodes, node_capacity, type_capacity, flags_capacity, parent_capacity, name_capacity;
+    uint32_t *node_table;           // open addressing on (parent, name), node id + 1
+    size_t node_table_size;
+} index_builder_t;
+
+static uint32_t bytes_hash(const char *s, size_t n)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < n; i++)
+    {
+        hash ^= (uint8_t)s[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static uint32_t pair_hash(uint32_t parent, uint32_t name)
+{
+    uint64_t key = ((uint64_t)parent << 32 | name) * 0x9E3779B97F4A7C15ull;
+    return key >> 32;
+}
+
+/**
+ * Private method
+ * Doubles an open addressing table, rehashing its ids with the given function
+ */
+static int rehash(index_builder_t *b, uint32_t **table, size_t *size, uint32_t (*hash_of)(index_builder_t *, uint32_t))
+{
+    size_t new_size = *size ? *size * 2 : 4096;
+    uint32_t *bigger = calloc(new_size, sizeof(uint32_t));
+    if (bigger == NULL)
+        return -1;
+    for (size_t i = 0; i < *size; i++)
+    {
+        if ((*table)[i] == 0)
+            continue;
+        size_t slot = hash_of(b, (*table)[i] - 1) & (new_size - 1);
+        while (bigger[slot])
+            slot = (slot + 1) & (new_size - 1);
+        bigger[slot] = (*table)[i];
+    }
+    free(*table);
+    *table = bigger;
+    *size = new_size;
+    return 0;
+}
+
+static uint32_t component_hash_of(index_builder_t *b, uint32_t id)
+{
+    const char *s = b->pool + b->component[id];
+    return bytes_hash(s, strlen(s));
+}
+
+static uint32_t node_hash_of(index_builder_t *b, uint32_t id)
+{
+    return pair_hash(b->parent[id], b->name[id]);
+}
+
+/**
+ * Private method
+ * Returns the id of a component name, adding it to the pool if it is new, or -1 on allocation failure
+ */
+static long intern(index_builder_t *b, const char *s, size_t n)
+{
+    if (2 * (b->components + 1) > b->component_table_size
+        && rehash(b, &b->component_table, &b->component_table_size, component_hash_of) != 0)
+        return -1;
+    size_t mask = b->component_table_size - 1;
+    size_t slot = bytes_hash(s, n) & mask;
+    while (b->component_table[slot])
+    {
+        uint32_t id = b->component_table[slot] - 1;
+        if (component_cmp(s, n, b->pool + b->component[id]) == 0)
+            return id;
+        slot = (slot + 1) & mask;
+    }
+    while (b->pool_size + n + 1 > b->pool_capacity)
+        if (grow((void **)&b->pool, &b->pool_capacity, b->pool_capacity, 1) != 0)
+            return -1;
+    if (grow((void **)&b->component, &b->component_capacity, b->components, sizeof(uint32_t)) != 0)
+        return -1;
+    memcpy(b->pool + b->pool_size, s, n);
+    b->pool[b->pool_size + n] = '\0';
+    b->component[b->components] = b->pool_size;
+    b->pool_size += n + 1;
+    b->component_table[slot] = ++b->components;
+    return b->components - 1;
+}
+
+/**
+ * Private method
+ * Returns the child of parent with the given component, creating it if needed, or -1 on allocation failure
+ */
+static long child_of(index_builder_t *b, uint32_t parent, uint32_t name)
+{
+    if (2 * (b->nodes + 1) > b->node_table_size
+        && rehash(b, &b->node_table, &b->node_table_size, node_hash_of) != 0)
+        return -1;
+    size_t mask = b->node_table_size - 1;
+    size_t slot = pair_hash(parent, name) & mask;
+    while (b->node_table[slot])
+    {
+        uint32_t id = b->node_table[slot] - 1;
+        if (b->parent[id] == parent && b->name[id] == name)
+            return id;
+        slot = (slot + 1) & mask;
+    }
+    if (grow((void **)&b->parent, &b->parent_capacity, b->nodes, sizeof(uint32_t)) != 0
+        || grow((void **)&b->name, &b->name_capacity, b->nodes, sizeof(uint32_t)) != 0
+        || grow((void **)&b->block, &b->node_capacity, b->nodes, sizeof(uint32_t)) != 0
+        || grow((void **)&b->type, &b->type_capacity, b->nodes, 1) != 0
+        || grow((void **)&b->flags, &b->flags_capacity, b->nodes, 1) != 0)
+        return -1;
+    b->parent[b->nodes] = parent;
+    b->name[b->nodes] = name;
+    b->block[b->nodes] = 0;
+    b->type[b->nodes] = 0;
+    b->flags[b->nodes] = 0;
+    b->node_table[slot] = ++b->nodes;
+    return b->nodes - 1;
+}
+
+/**
+ * Private method
+ * Creates node 0, the root is never looked up through the node table
+ */
+static int index_root(index_builder_t *b)
+{
+    if (grow((void **)&b->parent, &b->parent_capacity, 0, sizeof(uint32_t)) != 0
+        || grow((void **)&b->name, &b->name_capacity, 0, sizeof(uint32_t)) != 0
+        || grow((void **)&b->block, &b->node_capacity, 0, sizeof(uint32_t)) != 0
+        || grow((void **)&b->type, &b->type_capacity, 0, 1) != 0
+        || grow((void **)&b->flags, &b->flags_capacity, 0, 1) != 0)
+        return -1;
+    b->parent[0] = b->name[0] = b->block[0] = 0;
+    b->type[0] = b->flags[0] = 0;
+    b->nodes = 1;
+    return 0;
+}
+
+/**
+ * Private method
+ * Adds the header found at the given block, the first header of a path wins like in a scan
+ */
+static int index_add(index_builder_t *b, const char *path, uint32_t block, char typeflag)
+{
+    long node = 0;
+    const char *start = path;
+    const char *end;
+    // Same splitting as index_find()
+    while ((end = strchr(start, '/')) != NULL || *start != '\0')
+    {
+        size_t n = end ? end - start : strlen(start);
+        long name = intern(b, start, n);
+        if (name < 0 || (node = child_of(b, node, name)) < 0)
+            return -1;
+        if (end == NULL)
+            break;
+        start = end + 1;
+    }
+    int slash = end == NULL && *start == '\0';
+    if (node == 0 || (b->flags[node] & INDEX_ENTRY))
+        return 0;
+    b->block[node] = block;
+    b->type[node] = typeflag;
+    b->flags[node] = INDEX_ENTRY | (slash ? INDEX_SLASH : 0);
+    return 1;
+}
+
+typedef struct sort_item
+{
+    uint64_t key;
+    uint32_t id;
+} sort_item_t;
+
+static int sort_item_cmp(const void *a, const void *b)
+{
+    uint64_t x = ((const sort_item_t *)a)->key, y = ((const sort_item_t *)b)->key;
+    return x < y ? -1 : x > y;
+}
+
+static int string_cmp(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/**
+ * Private method
+ * Lays the builder out as a tar_index_t: components sorted by name, children contiguous and sorted
+ */
+static tar_index_t *index_finish(index_builder_t *b, uint32_t entries)
+{
+    tar_index_t *index = calloc(1, sizeof(tar_index_t));
+    char **names = malloc((b->components + 1) * sizeof(char *));
+    uint32_t *rename = malloc((b->components + 1) * sizeof(uint32_t));     // old id to new pool offset
+    sort_item_t *items = malloc(b->nodes * sizeof(sort_item_t));
+    uint32_t *start = calloc(b->nodes + 1, sizeof(uint32_t));
+    uint32_t *order = malloc(b->nodes * sizeof(uint32_t));
+    uint64_t *hash = malloc(b->nodes * sizeof(uint64_t));                 // hash of the path of each node
+    uint8_t *level = malloc(b->nodes);
+    size_t n = b->nodes;
+    // Three quarters full, probes rarely leave the cache line of the first slot
+    size_t slots = n + n / 3 + 1;
+    if (b->pool_size > UINT32_MAX || slots > UINT32_MAX)
+        goto fail;
+    if (index == NULL || names == NULL || rename == NULL || items == NULL || start == NULL || order == NULL
+        || hash == NULL || level == NULL)
+        goto fail;
+    // Padded so that a lookup compares a whole component against any name without reading past the pool
+    index->pool = index_alloc(b->pool_size + TAR_PATH_SIZE);
+    index->trie = index_alloc((n + 1) * sizeof(index_node_t));
+    index->meta = index_alloc(n * sizeof(index_meta_t));
+    index->table = index_alloc(slots * sizeof(index_slot_t));
+    if (index->pool == NULL || index->trie == NULL || index->meta == NULL || index->table == NULL)
+        goto fail;
+    memset(index->pool + b->pool_size, 0, TAR_PATH_SIZE);
+    memset(index->table, 0, slots * sizeof(index_slot_t));
+
+    // Sort the component names, offsets in the new pool then compare like the names
+    for (size_t i = 0; i < b->components; i++)
+        names[i] = b->pool + b->component[i];
+    qsort(names, b->components, sizeof(char *), string_cmp);
+    index->pool_size = 0;
+    for (size_t i = 0; i < b->components; i++)
+    {
+        size_t length = strlen(names[i]) + 1;
+        memcpy(index->pool + index->pool_size, names[i], length);
+        // Old pool offsets are in id order, find the old id back by binary search
+        uint32_t offset = names[i] - b->pool, low = 0, high = b->components;
+        while (b->component[low + (high - low) / 2] != offset)
+        {
+            if (b->component[low + (high - low) / 2] < offset)
+                low = low + (high - low) / 2 + 1;
+            else
+                high = low + (high - low) / 2;
+        }
+        rename[low + (high - low) / 2] = index->pool_size;
+        index->pool_size += length;
+    }
+    index->components = b->components;
+
+    // Group the nodes by parent, sorted by name inside a group
+    for (size_t i = 1; i < n; i++)
+    {
+        items[i - 1].key = (uint64_t)b->parent[i] << 32 | rename[b->name[i]];
+        items[i - 1].id = i;
+        start[b->parent[i] + 1]++;
+    }
+    qsort(items, n - 1, sizeof(sort_item_t), sort_item_cmp);
+    for (size_t i = 0; i < n; i++)
+        start[i + 1] += start[i];
+
+    // Number the nodes breadth first so that siblings get consecutive ids
+    uint32_t next = 1;
+    order[0] = 0;
+    for (uint32_t new_id = 0; new_id < next; new_id++)
+    {
+        uint32_t old = order[new_id];
+        index->trie[new_id].name = new_id ? rename[b->name[old]] : 0;
+        index->trie[new_id].block = b->block[old];
+        index->meta[new_id].type = b->type[old];
+        index->meta[new_id].flags = b->flags[old];
+        index->trie[new_id].first_child = next;
+        for (uint32_t i = start[old]; i < start[old + 1]; i++)
+            order[next++] = items[i].id;
+    }
+    index->trie[n].name = index->trie[n].block = 0;
+    index->trie[n].first_child = n;
+    index->nodes = n;
+    index->entries = entries;
+
+    // Parents come before their children, so the hash of a path continues the hash of its parent
+    index->slots = slots;
+    index->depth = 0;
+    hash[0] = 0;
+    level[0] = 0;
+    for (uint32_t parent = 0; parent < n; parent++)
+    {
+        for (uint32_t child = index->trie[parent].first_child; child < index->trie[parent + 1].first_child; child++)
+        {
+            const char *name = index->pool + index->trie[child].name;
+            hash[child] = index_hash(hash[parent], name, strlen(name));
+            level[child] = level[parent] + 1;
+            if (level[child] > index->depth)
+                index->depth = level[child];
+            size_t slot = index_slot(index, hash[child]);
+            while (index->table[slot].node != 0)
+                slot = slot + 1 == slots ? 0 : slot + 1;
+            index->table[slot].node = child;
+            index->table[slot].name = index->trie[child].name;
+        }
+    }
+
+    free(names);
+    free(rename);
+    free(items);
+    free(start);
+    free(order);
+    free(hash);
+    free(level);
+    return index;
+
+fail:
+    if (index != NULL)
+    {
+        free(index->pool);
+        free(index->trie);
+        free(index->meta);
+        free(index->table);
+    }
+    free(index);
+    free(names);
+    free(rename);
+    free(items);
+    free(start);
+    free(order);
+    free(hash);
+    free(level);
+    return NULL;
+}
+
+static void builder_free(index_builder_t *b)
+{
+    free(b->pool);
+    free(b->component);
+    free(b->component_table);
+    free(b->parent);
+    free(b->name);
+    free(b->block);
+    free(b->type);
+    free(b->flags);
+    free(b->node_table);
+}
+
+/**
+ * Private method
+ * list() on an indexed archive, entries are listed in archive order
+ */
+static int index_list(int tar_fd, tar_index_t *index, char *path, char **entries, size_t *no_entries)
+{
+    tar_header_t head;
+    // Only ever holds the exact name of a header, so no longer than a header name and a '/'
+    char directory[sizeof(head.name) + 2];
+    long node = index_find(index, path);
+    if (node < 0)
+        return 0;
+    snprintf(directory, sizeof(directory), "%s", path);
+    int hops = 0;
+    // Resolve symlinks, a link to "dir" means "dir/"
+    while (index->meta[node].type == SYMTYPE)
+    {
+        if (++hops > 16 || index_header(tar_fd, index, node, &head) != 0)
+            return 0;
+        size_t length = strnlen(head.linkname, sizeof(head.linkname));
+        memcpy(directory, head.linkname, length);
+        directory[length] = '\0';
+        if (memchr(directory, '/', length) == NULL)
+            strcpy(directory + length, "/");
+        if ((node = index_find(index, directory)) < 0)
+            return 0;
+    }
+    if (index->meta[node].type != DIRTYPE)
+        return 0;
+
+    uint32_t first = index->trie[node].first_child, count = index->trie[node + 1].first_child - first;
+    sort_item_t *children = malloc((count ? count : 1) * sizeof(sort_item_t));
+    if (children == NULL)
+        return 0;
+    size_t found = 0;
+    for (uint32_t child = first; child < first + count; child++)
+    {
+        // Directories that only appear in longer paths have no header to list
+        if (index->meta[child].flags & INDEX_ENTRY)
+        {
+            children[found].key = index->trie[child].block;
+            children[found].id = child;
+            found++;
+        }
+    }
+    qsort(children, found, sizeof(sort_item_t), sort_item_cmp);
+    size_t counter = 0;
+    for (; counter < found && counter < *no_entries; counter++)
+    {
+        uint32_t child = children[counter].id;
+        // The directory and a child component give back the exact name of the child header,
+        // which fits in TAR_PATH_SIZE, the bound only guards against a corrupted index
+        int written = snprintf(entries[counter], TAR_PATH_SIZE, "%s%s%s", directory, index->pool + index->trie[child].name,
+                               index->meta[child].flags & INDEX_SLASH ? "/" : "");
+        if (written < 0)
+            entries[counter][0] = '\0';
+    }
+    free(children);
+    *no_entries = counter;
+    return 1;
+}
+
+/**
+ * Builds an index of the paths of the archive.
+ *
+ * Once built, exists(), is_dir(), is_file(), is_symlink(), tar_typeflag() and list() look paths
+ * up in the index instead of scanning the archive, and read_file() only reads the headers it needs. They match
+ * paths exactly against the header names, as the scans do.
+ * The archive must not change while the index is in use. Call tar_index_free() before closing
+ * tar_fd: the library trusts the index of a descriptor number, whatever file it refers to, until
+ * tar_index_free() or tar_index_build() is called on it.
+ *
+ * @param tar_fd A file descriptor pointing to the start of a valid tar archive file.
+ *
+ * @return the number of entries indexed,
+ *         -1 if tar_fd is out of range, an index is already built for it, the archive is bigger
+ *         than 2 TiB or memory could not be allocated.
+ */
+int tar_index_build(int tar_fd)
+{
+    struct stat st;
+    if (tar_fd < 0 || tar_fd >= TAR_MAX_HANDLES || fstat(tar_fd, &st) != 0)
+        return -1;
+    if (indexes[tar_fd] != NULL && same_file(tar_fd, indexes[tar_fd]->dev, indexes[tar_fd]->ino))
+        return -1;
+    // Left behind by an archive closed without tar_index_free()
+    if (indexes[tar_fd] != NULL)
+        tar_index_free(tar_fd);
+    index_builder_t b;
+    memset(&b, 0, sizeof(index_builder_t));
+    tar_header_t head;
+    char path[sizeof(head.name) + 1];
+    off_t position = 0;
+    uint32_t entries = 0;
+    int failed = index_root(&b);
+    while (!failed && pread(tar_fd, &head, sizeof(tar_header_t), position) == sizeof(tar_header_t))
+    {
+        if (position / sizeof(tar_header_t) > UINT32_MAX)
+        {
+            failed = 1;
+            break;
+        }
+        if (head.name[0] != '\0')
+        {
+            // Like the scans, only the name field is matched, the prefix is ignored
+            size_t name_length = strnlen(head.name, sizeof(head.name));
+            memcpy(path, head.name, name_length);
+            path[name_length] = '\0';
+            int added = index_add(&b, path, position / sizeof(tar_header_t), head.typeflag);
+            if (added < 0)
+                failed = 1;
+            entries += added > 0;
+            size_t file_size = TAR_INT(head.size);
+            position += (file_size + sizeof(tar_header_t) - 1) / sizeof(tar_header_t) * sizeof(tar_header_t);
+        }
+        position += sizeof(tar_header_t);
+    }
+    tar_index_t *index = failed ? NULL : index_finish(&b, entries);
+    builder_free(&b);
+    if (index == NULL)
+        return -1;
+    index->dev = st.st_dev;
+    index->ino = st.st_ino;
+    indexes[tar_fd] = index;
+    return entries;
+}
+
+/**
+ * Frees the index of the given archive, the library goes back to scanning it.
+ *
+ * @param tar_fd A file descriptor with an index built by tar_index_build().
+ */
+void tar_index_free(int tar_fd)
+{
+    if (tar_fd < 0 || tar_fd >= TAR_MAX_HANDLES || indexes[tar_fd] == NULL)
+        return;
+    tar_index_t *index = indexes[tar_fd];
+    indexes[tar_fd] = NULL;
+    free(index->pool);
+    free(index->trie);
+    free(index->meta);
+    free(index->table);
+    free(index);
+}
+
+/**
+ * Reads the size of the index of the given archive.
+ *
+ * @param tar_fd A file descriptor with an index built by tar_index_build().
+ * @param stats A destination structure for the figures.
+ *
+ * @return zero if the figures were written to stats,
+ *         -1 if no index is built for tar_fd.
+ */
+int tar_index_stats(int tar_fd, tar_index_stats_t *stats)
+{
+    tar_index_t *index = index_of(tar_fd);
+    if (index == NULL)
+        return -1;
+    stats->entries = index->entries;
+    stats->nodes = index->nodes;
+    stats->components = index->components;
+    stats->bytes = sizeof(tar_index_t) + index->pool_size + (index->nodes + 1) * sizeof(index_node_t)
+                   + index->nodes * sizeof(index_meta_t) + index->slots * sizeof(index_slot_t);
+    return 0;
+}
+
 /**
  * Checks whether the archive is valid.
  *
@@ -76,6 +838,9 @@ int check_archive(int tar_fd)
  */
 int exists(int tar_fd, char *path)
 {
+    tar_index_t *index = index_of(tar_fd);
+    if (index != NULL)
+        return index_find(index, path) >= 0;
     tar_header_t *head = malloc(sizeof(tar_header_t));
     lseek(tar_fd, 0, SEEK_SET);
     while (read(tar_fd, head, sizeof(tar_header_t)) > 0)
@@ -103,6 +868,12 @@ int exists(int tar_fd, char *path)
  */
 int is_dir(int tar_fd, char *path)
 {
+    tar_index_t *index = index_of(tar_fd);
+    if (index != NULL)
+    {
+        long node = index_find(index, path);
+        return node >= 0 && index->meta[node].type == DIRTYPE;
+    }
     if (exists(tar_fd, path) == 0)
         return 0;
     tar_header_t *head = malloc(sizeof(tar_header_t));
@@ -134,6 +905,12 @@ int is_dir(int tar_fd, char *path)
  */
 int is_file(int tar_fd, char *path)
 {
+    tar_index_t *index = index_of(tar_fd);
+    if (index != NULL)
+    {
+        long node = index_find(index, path);
+        return node >= 0 && (index->meta[node].type == REGTYPE || index->meta[node].type == AREGTYPE);
+    }
     if (exists(tar_fd, path) == 0)
         return 0;
     tar_header_t *head = malloc(sizeof(tar_header_t));
@@ -164,6 +941,12 @@ int is_file(int tar_fd, char *path)
  */
 int is_symlink(int tar_fd, char *path)
 {
+    tar_index_t *index = index_of(tar_fd);
+    if (index != NULL)
+    {
+        long node = index_find(index, path);
+        return node >= 0 && index->meta[node].type == SYMTYPE;
+    }
     if (exists(tar_fd, path) == 0)
         return 0;
     tar_header_t *head = malloc(sizeof(tar_header_t));
@@ -198,7 +981,7 @@ int is_symlink(int tar_fd, char *path)
  *
  * @param tar_fd A file descriptor pointing to the start of a valid tar archive file.
  * @param path A path to an entry in the archive. If the entry is a symlink, it must be resolved to its linked-to entry.
- * @param entries An array of char arrays, each one is long enough to contain a tar entry path.
+ * @param entries An array of char arrays, each one is long enough to contain a tar entry path (TAR_PATH_SIZE).
  * @param no_entries An in-out argument.
  *                   The caller set it to the number of entries in `entries`.
  *                   The callee set it to the number of entries listed.
@@ -218,6 +1001,9 @@ int nombre_d_occurence(char * string, char character)
 
 int list(int tar_fd, char *path, char **entries, size_t *no_entries)
 {
+    tar_index_t *index = index_of(tar_fd);
+    if (index != NULL)
+        return index_list(tar_fd, index, path, entries, no_entries);
     if (is_dir(tar_fd, path) == 0 && is_symlink(tar_fd, path) == 0)
         return 0;
     tar_header_t *head = malloc(sizeof(tar_header_t));
@@ -236,7 +1022,7 @@ int list(int tar_fd, char *path, char **entries, size_t *no_entries)
                 } else {
                     length = strlen(head->linkname);
                 }
-                char new_directory[length];
+                char new_directory[length + 1];
                 strcpy(new_directory, head->linkname);
                 if(nombre_d_occurence(head->linkname, '/') == 0) {
                     new_directory[length-1] = '/';
@@ -276,25 +1062,390 @@ int list(int tar_fd, char *path, char **entries, size_t *no_entries)
     return 0;
 }
 
+typedef struct cache_node
+{
+    char *name;                         // resolved path of the member, or path of a symlink
+    char *target;                       // resolved path the symlink leads to, NULL for a member
+    uint8_t *data;                      // whole content of the member
+    size_t size;
+    size_t charge;                      // bytes charged against the shard budget
+    struct cache_node *hnext;           // next node in the same bucket
+    struct cache_node *prev, *next;     // LRU list, most recently used first
+} cache_node_t;
+
+typedef struct cache_shard
+{
+    pthread_mutex_t lock;
+    cache_node_t *buckets[TAR_CACHE_BUCKETS];
+    cache_node_t *head, *tail;
+    size_t budget, bytes, entries;
+    uint64_t hits, misses, evictions;
+} cache_shard_t;
+
+typedef struct tar_cache
+{
+    dev_t dev;                          // identity of the archive the cache was enabled on
+    ino_t ino;
+    size_t max_member_size;
+    cache_shard_t shards[TAR_CACHE_SHARDS];
+} tar_cache_t;
+
+static tar_cache_t *caches[TAR_MAX_HANDLES];
+
+/* Most bytes a member costs on top of its content: its node and its path */
+#define CACHE_NODE_OVERHEAD (sizeof(cache_node_t) + sizeof(((tar_header_t *)0)->name) + 1)
+
 /**
- * Reads a file at a given path in the archive.
+ * Private method
+ * FNV-1a hash of a path, picks both the shard and the bucket
+ */
+static uint32_t cache_hash(const char *name)
+{
+    uint32_t hash = 2166136261u;
+    while (*name)
+    {
+        hash ^= (uint8_t)*name++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static tar_cache_t *cache_of(int tar_fd)
+{
+    if (tar_fd < 0 || tar_fd >= TAR_MAX_HANDLES)
+        return NULL;
+    return caches[tar_fd];
+}
+
+/**
+ * Private method
+ * Copies the requested window of a member, same return values as read_file()
+ */
+static ssize_t copy_member(const uint8_t *data, size_t file_size, size_t offset, uint8_t *dest, size_t *len)
+{
+    if (offset > file_size)
+        return -2;
+    size_t readable = file_size - offset < *len ? file_size - offset : *len;
+    memcpy(dest, data + offset, readable);
+    *len = readable;
+    return file_size - offset - readable;
+}
+
+static void lru_unlink(cache_shard_t *shard, cache_node_t *node)
+{
+    if (node->prev) node->prev->next = node->next;
+    else shard->head = node->next;
+    if (node->next) node->next->prev = node->prev;
+    else shard->tail = node->prev;
+    node->prev = node->next = NULL;
+}
+
+static void lru_push_front(cache_shard_t *shard, cache_node_t *node)
+{
+    node->prev = NULL;
+    node->next = shard->head;
+    if (shard->head) shard->head->prev = node;
+    shard->head = node;
+    if (shard->tail == NULL) shard->tail = node;
+}
+
+/**
+ * Private method
+ * Removes the least recently used member of the shard, the shard lock must be held
+ */
+static void cache_evict_one(cache_shard_t *shard)
+{
+    cache_node_t *victim = shard->tail;
+    cache_node_t **link = &shard->buckets[(cache_hash(victim->name) / TAR_CACHE_SHARDS) % TAR_CACHE_BUCKETS];
+    while (*link != victim)
+        link = &(*link)->hnext;
+    *link = victim->hnext;
+    lru_unlink(shard, victim);
+    shard->bytes -= victim->charge;
+    if (victim->target == NULL)
+    {
+        shard->entries--;
+        shard->evictions++;
+    }
+    free(victim->name);
+    free(victim->target);
+    free(victim->data);
+    free(victim);
+}
+
+/**
+ * Private method
+ * Serves a read from the cache, a cached symlink leads to the member it resolves to if follow is set
+ * Returns 1 and sets *ret if the member is cached, 0 otherwise
+ */
+static int cache_lookup(tar_cache_t *cache, const char *name, size_t offset, uint8_t *dest, size_t *len, ssize_t *ret, int follow)
+{
+    char target[PATH_SIZE];
+    uint32_t hash = cache_hash(name);
+    cache_shard_t *shard = &cache->shards[hash % TAR_CACHE_SHARDS];
+    pthread_mutex_lock(&shard->lock);
+    cache_node_t *node = shard->buckets[(hash / TAR_CACHE_SHARDS) % TAR_CACHE_BUCKETS];
+    while (node != NULL && strcmp(node->name, name) != 0)
+        node = node->hnext;
+    if (node == NULL || (node->target != NULL && !follow))
+    {
+        pthread_mutex_unlock(&shard->lock);
+        return 0;
+    }
+    if (shard->head != node)
+    {
+        lru_unlink(shard, node);
+        lru_push_front(shard, node);
+    }
+    if (node->target != NULL)
+    {
+        // The target lives in its own shard, never hold two shard locks at once
+        strcpy(target, node->target);
+        pthread_mutex_unlock(&shard->lock);
+        return cache_lookup(cache, target, offset, dest, len, ret, 0);
+    }
+    shard->hits++;
+    // Copy while holding the lock so the member can not be evicted under our feet
+    *ret = copy_member(node->data, node->size, offset, dest, len);
+    pthread_mutex_unlock(&shard->lock);
+    return 1;
+}
+
+static int cache_get(tar_cache_t *cache, const char *name, size_t offset, uint8_t *dest, size_t *len, ssize_t *ret)
+{
+    return cache_lookup(cache, name, offset, dest, len, ret, 1);
+}
+
+static void cache_count_miss(tar_cache_t *cache, const char *name)
+{
+    cache_shard_t *shard = &cache->shards[cache_hash(name) % TAR_CACHE_SHARDS];
+    pthread_mutex_lock(&shard->lock);
+    shard->misses++;
+    pthread_mutex_unlock(&shard->lock);
+}
+
+/**
+ * Private method
+ * Inserts a member in the cache, takes ownership of data
+ * With a target instead of data, remembers that the symlink name resolves to the member target
+ */
+static void cache_put(tar_cache_t *cache, const char *name, const char *target, uint8_t *data, size_t size)
+{
+    uint32_t hash = cache_hash(name);
+    cache_shard_t *shard = &cache->shards[hash % TAR_CACHE_SHARDS];
+    size_t charge = sizeof(cache_node_t) + strlen(name) + 1 + (target ? strlen(target) + 1 : 0) + size;
+    cache_node_t *node = malloc(sizeof(cache_node_t));
+    char *key = strdup(name);
+    char *link = target ? strdup(target) : NULL;
+    if (charge > shard->budget || node == NULL || key == NULL || (target != NULL && link == NULL))
+    {
+        free(node);
+        free(key);
+        free(link);
+        free(data);
+        return;
+    }
+    node->name = key;
+    node->target = link;
+    node->data = data;
+    node->size = size;
+    node->charge = charge;
+
+    pthread_mutex_lock(&shard->lock);
+    cache_node_t **bucket = &shard->buckets[(hash / TAR_CACHE_SHARDS) % TAR_CACHE_BUCKETS];
+    for (cache_node_t *other = *bucket; other != NULL; other = other->hnext)
+    {
+        // Another reader cached it in the meantime
+        if (strcmp(other->name, name) == 0)
+        {
+            pthread_mutex_unlock(&shard->lock);
+            free(key);
+            free(link);
+            free(data);
+            free(node);
+            return;
+        }
+    }
+    while (shard->bytes + charge > shard->budget)
+        cache_evict_one(shard);
+    node->hnext = *bucket;
+    *bucket = node;
+    lru_push_front(shard, node);
+    shard->bytes += charge;
+    shard->entries += target == NULL;
+    pthread_mutex_unlock(&shard->lock);
+}
+
+/**
+ * Private method
+ * Looks for the regular file at path, following symlinks, without moving the file offset of tar_fd
+ * Uses the index of the archive if there is one, scans the headers otherwise
+ * Sets resolved to the path of the file, data_offset to the position of its content and size to its size
+ * Returns zero if found, -1 if there is no such file
+ */
+static int locate_file(int tar_fd, char *path, char *resolved, off_t *data_offset, size_t *size)
+{
+    tar_header_t head;
+    off_t position = 0;
+    int hops = 0;
+    strncpy(resolved, path, PATH_SIZE - 1);
+    resolved[PATH_SIZE - 1] = '\0';
+    tar_index_t *index = index_of(tar_fd);
+    while (index != NULL)
+    {
+        long node = index_find(index, resolved);
+        if (node < 0 || index_header(tar_fd, index, node, &head) != 0)
+            return -1;
+        if (head.typeflag == SYMTYPE)
+        {
+            if (++hops > 16)
+                return -1;
+            memcpy(resolved, head.linkname, sizeof(head.linkname));
+            resolved[sizeof(head.linkname)] = '\0';
+            continue;
+        }
+        if (head.typeflag != REGTYPE && head.typeflag != AREGTYPE)
+            return -1;
+        *data_offset = (off_t)index->trie[node].block * sizeof(tar_header_t) + sizeof(tar_header_t);
+        *size = TAR_INT(head.size);
+        return 0;
+    }
+    while (pread(tar_fd, &head, sizeof(tar_header_t), position) == sizeof(tar_header_t))
+    {
+        position += sizeof(tar_header_t);
+        if (head.name[0] == '\0')
+            continue;
+        if (strncmp(head.name, resolved, sizeof(head.name)) == 0 && strlen(resolved) <= sizeof(head.name))
+        {
+            if (head.typeflag == SYMTYPE)
+            {
+                // Start over with the linked-to entry, giving up on symlink loops
+                if (++hops > 16)
+                    return -1;
+                memcpy(resolved, head.linkname, sizeof(head.linkname));
+                resolved[sizeof(head.linkname)] = '\0';
+                position = 0;
+                continue;
+            }
+            if (head.typeflag != REGTYPE && head.typeflag != AREGTYPE)
+                return -1;
+            *data_offset = position;
+            *size = TAR_INT(head.size);
+            return 0;
+        }
+        size_t file_size = TAR_INT(head.size);
+        position += (file_size + sizeof(tar_header_t) - 1) / sizeof(tar_header_t) * sizeof(tar_header_t);
+    }
+    return -1;
+}
+
+/**
+ * Enables a content cache in front of read_file() for the given archive.
+ *
+ * The cache is a sharded LRU keyed by the resolved entry (symlinks are followed before caching).
+ * The entry a symlink resolves to is remembered too, so that reading through it again skips the lookup.
+ * Only members of at most `max_member_size` bytes are admitted, and the memory used by the cached
+ * members never exceeds `budget` bytes. Once enabled, read_file() on this archive no longer moves
+ * the file offset of `tar_fd` and can be called from several threads at once.
+ *
+ * The budget is split evenly between TAR_CACHE_SHARDS shards and a member must fit in one of them,
+ * so `max_member_size` plus a few hundred bytes of bookkeeping must not exceed budget / TAR_CACHE_SHARDS.
+ * Call tar_cache_disable() before closing tar_fd: read_file() trusts the cache of a descriptor number,
+ * whatever file it refers to, until tar_cache_disable() or tar_cache_enable() is called on it.
  *
  * @param tar_fd A file descriptor pointing to the start of a valid tar archive file.
- * @param path A path to an entry in the archive to read from.  If the entry is a symlink, it must be resolved to its linked-to entry.
- * @param offset An offset in the file from which to start reading from, zero indicates the start of the file.
- * @param dest A destination buffer to read the given file into.
- * @param len An in-out argument.
- *            The caller set it to the size of dest.
- *            The callee set it to the number of bytes written to dest.
+ * @param budget The maximum number of bytes the cache may hold.
+ * @param max_member_size The size of the largest member that may be cached.
  *
- * @return -1 if no entry at the given path exists in the archive or the entry is not a file,
- *         -2 if the offset is outside the file total length,
- *         zero if the file was read in its entirety into the destination buffer,
- *         a positive value if the file was partially read, representing the remaining bytes left to be read to reach
- *         the end of the file.
+ * @return zero if the cache was enabled,
+ *         -1 if tar_fd is out of range, a cache is already enabled for it, max_member_size does not fit
+ *         in one shard of the budget or memory could not be allocated.
+ */
+int tar_cache_enable(int tar_fd, size_t budget, size_t max_member_size)
+{
+    struct stat st;
+    if (tar_fd < 0 || tar_fd >= TAR_MAX_HANDLES || fstat(tar_fd, &st) != 0)
+        return -1;
+    if (caches[tar_fd] != NULL && same_file(tar_fd, caches[tar_fd]->dev, caches[tar_fd]->ino))
+        return -1;
+    // A member and its bookkeeping must fit in one shard, or it could never be admitted
+    if (max_member_size > budget / TAR_CACHE_SHARDS
+        || budget / TAR_CACHE_SHARDS - max_member_size < CACHE_NODE_OVERHEAD)
+        return -1;
+    // Left behind by an archive closed without tar_cache_disable()
+    if (caches[tar_fd] != NULL)
+        tar_cache_disable(tar_fd);
+    tar_cache_t *cache = calloc(1, sizeof(tar_cache_t));
+    if (cache == NULL)
+        return -1;
+    cache->dev = st.st_dev;
+    cache->ino = st.st_ino;
+    cache->max_member_size = max_member_size;
+    for (int i = 0; i < TAR_CACHE_SHARDS; i++)
+    {
+        pthread_mutex_init(&cache->shards[i].lock, NULL);
+        cache->shards[i].budget = budget / TAR_CACHE_SHARDS;
+    }
+    caches[tar_fd] = cache;
+    return 0;
+}
+
+/**
+ * Disables the content cache of the given archive and frees its memory.
+ * Must not be called while other threads are still reading from the archive.
  *
+ * @param tar_fd A file descriptor with a cache enabled by tar_cache_enable().
  */
-ssize_t read_file(int tar_fd, char *path, size_t offset, uint8_t *dest, size_t *len)
+void tar_cache_disable(int tar_fd)
+{
+    if (tar_fd < 0 || tar_fd >= TAR_MAX_HANDLES || caches[tar_fd] == NULL)
+        return;
+    tar_cache_t *cache = caches[tar_fd];
+    caches[tar_fd] = NULL;
+    for (int i = 0; i < TAR_CACHE_SHARDS; i++)
+    {
+        cache_shard_t *shard = &cache->shards[i];
+        while (shard->tail != NULL)
+            cache_evict_one(shard);
+        pthread_mutex_destroy(&shard->lock);
+    }
+    free(cache);
+}
+
+/**
+ * Reads the counters of the content cache of the given archive.
+ *
+ * @param tar_fd A file descriptor with a cache enabled by tar_cache_enable().
+ * @param stats A destination structure for the counters.
+ *
+ * @return zero if the counters were written to stats,
+ *         -1 if no cache is enabled for tar_fd.
+ */
+int tar_cache_stats(int tar_fd, tar_cache_stats_t *stats)
+{
+    tar_cache_t *cache = cache_of(tar_fd);
+    if (cache == NULL)
+        return -1;
+    memset(stats, 0, sizeof(tar_cache_stats_t));
+    for (int i = 0; i < TAR_CACHE_SHARDS; i++)
+    {
+        cache_shard_t *shard = &cache->shards[i];
+        pthread_mutex_lock(&shard->lock);
+        stats->hits += shard->hits;
+        stats->misses += shard->misses;
+        stats->evictions += shard->evictions;
+        stats->entries += shard->entries;
+        stats->bytes += shard->bytes;
+        pthread_mutex_unlock(&shard->lock);
+    }
+    return 0;
+}
+
+/**
+ * Private method
+ * read_file() without cache, scans the archive for the header of the file and reads it from disk
+ */
+static ssize_t read_file_uncached(int tar_fd, char *path, size_t offset, uint8_t *dest, size_t *len)
 {
     // Checks if the given file exists and if it's a file or a symlink
     if (is_file(tar_fd, path) == 0 && is_symlink(tar_fd, path) == 0)
@@ -320,7 +1471,7 @@ ssize_t read_file(int tar_fd, char *path, size_t offset, uint8_t *dest, size_t *
                 if (strcmp(head->name, file) == 0) {
                     int file_size = strtol(head->size, NULL, 8);
                     if(offset > file_size) return -2;
-                    size_t readable = *len > file_size ? file_size - offset : *len;
+                    size_t readable = file_size - offset < *len ? file_size - offset : *len;
                     lseek(tar_fd, offset, SEEK_CUR);
                     *len = read(tar_fd, dest, readable);
                     if(file_size > *len) return file_size - *len - offset;
@@ -333,4 +1484,119 @@ ssize_t read_file(int tar_fd, char *path, size_t offset, uint8_t *dest, size_t *
         }
     }
     return 0;
-}
\ No newline at end of file
+}
+
+/**
+ * Reads a file at a given path in the archive.
+ *
+ * @param tar_fd A file descriptor pointing to the start of a valid tar archive file.
+ * @param path A path to an entry in the archive to read from.  If the entry is a symlink, it must be resolved to its linked-to entry.
+ * @param offset An offset in the file from which to start reading from, zero indicates the start of the file.
+ * @param dest A destination buffer to read the given file into.
+ * @param len An in-out argument.
+ *            The caller set it to the size of dest.
+ *            The callee set it to the number of bytes written to dest.
+ *
+ * @return -1 if no entry at the given path exists in the archive or the entry is not a file,
+ *         -2 if the offset is outside the file total length,
+ *         zero if the file was read in its entirety into the destination buffer,
+ *         a positive value if the file was partially read, representing the remaining bytes left to be read to reach
+ *         the end of the file.
+ *
+ */
+ssize_t read_file(int tar_fd, char *path, size_t offset, uint8_t *dest, size_t *len)
+{
+    tar_cache_t *cache = cache_of(tar_fd);
+    if (cache == NULL && index_of(tar_fd) == NULL)
+        return read_file_uncached(tar_fd, path, offset, dest, len);
+
+    ssize_t ret;
+    // Members are cached under their own path and symlinks lead to them, this is the hot path
+    if (cache != NULL && cache_get(cache, path, offset, dest, len, &ret))
+        return ret;
+    char resolved[PATH_SIZE];
+    off_t data_offset;
+    size_t file_size;
+    if (locate_file(tar_fd, path, resolved, &data_offset, &file_size) != 0)
+        return -1;
+    if (cache != NULL && strcmp(resolved, path) != 0)
+    {
+        // Next time the symlink goes straight to the member, without locating it
+        cache_put(cache, path, resolved, NULL, 0);
+        if (cache_get(cache, resolved, offset, dest, len, &ret))
+            return ret;
+    }
+    if (cache != NULL)
+        cache_count_miss(cache, resolved);
+
+    if (offset > file_size)
+        return -2;
+    if (cache != NULL && file_size <= cache->max_member_size)
+    {
+        uint8_t *data = malloc(file_size ? file_size : 1);
+        if (data != NULL && pread(tar_fd, data, file_size, data_offset) == file_size)
+        {
+            ret = copy_member(data, file_size, offset, dest, len);
+            cache_put(cache, resolved, NULL, data, file_size);
+            return ret;
+        }
+        free(data);
+    }
+    // Not cached, read the requested window only
+    size_t readable = file_size - offset < *len ? file_size - offset : *len;
+    ssize_t got = pread(tar_fd, dest, readable, data_offset + offset);
+    *len = got > 0 ? got : 0;
+    return file_size - offset - *len;
+}
+
+/**
+ * Finds where the content of a file is stored in the archive, without reading it.
+ * Lets a caller read the file itself, e.g. with pread() on the archive or on a copy of tar_fd.
+ *
+ * @param tar_fd A file descriptor pointing to the start of a valid tar archive file.
+ * @param path A path to an entry in the archive. If the entry is a symlink, it must be resolved to its linked-to entry.
+ * @param data_offset Set to the position of the first byte of the file in the archive.
+ * @param size Set to the size of the file.
+ *
+ * @return zero if the file was found,
+ *         -1 if no entry at the given path exists in the archive or the entry is not a file.
+ */
+int tar_locate(int tar_fd, char *path, off_t *data_offset, size_t *size)
+{
+    char resolved[PATH_SIZE];
+    return locate_file(tar_fd, path, resolved, data_offset, size);
+}
+
+/**
+ * Gives the type of an entry in the archive, with a single lookup where exists(), is_dir(),
+ * is_file() and is_symlink() would need one each.
+ *
+ * @param tar_fd A file descriptor pointing to the start of a valid tar archive file.
+ * @param path A path to an entry in the archive.
+ *
+ * @return the typeflag of the header of the entry (REGTYPE, AREGTYPE, DIRTYPE, SYMTYPE...),
+ *         -1 if no entry at the given path exists in the archive.
+ */
+int tar_typeflag(int tar_fd, char *path)
+{
+    tar_index_t *index = index_of(tar_fd);
+    if (index != NULL)
+    {
+        long node = index_find(index, path);
+        return node >= 0 ? index->meta[node].type : -1;
+    }
+    tar_header_t head;
+    lseek(tar_fd, 0, SEEK_SET);
+    while (read(tar_fd, &head, sizeof(tar_header_t)) > 0)
+    {
+        if (strcmp((char *)&head, "\0"))
+        {
+            if (strcmp(head.name, path) == 0)
+                return (unsigned char)head.typeflag;
+            int offset = strtol(head.size, NULL, 8);
+            int size = sizeof(tar_header_t);
+            lseek(tar_fd, offset % size ? (floor(offset / size) + 1) * size : offset, SEEK_CUR);
+        }
+    }
+    return -1;
+}
@@ -11,6 +11,7 @@
 #include <fcntl.h>
 #include <string.h>
 #include <math.h>
+#include <pthread.h>
 
 typedef struct posix_header
 {                              /* byte offset */
@@ -48,6 +49,31 @@ typedef struct posix_header
 /* Converts an ASCII-encoded octal-based number into a regular integer */
 #define TAR_INT(char_ptr) strtol(char_ptr, NULL, 8)
 
+/* Size of the buffers list() writes entry paths to, a header name and its NUL */
+#define TAR_PATH_SIZE 101
+
+/* Content cache settings */
+#define TAR_MAX_HANDLES   1024  /* highest tar_fd (exclusive) that can get a cache or an index */
+#define TAR_CACHE_SHARDS  16    /* number of independently locked LRU shards */
+#define TAR_CACHE_BUCKETS 64    /* hash buckets per shard */
+
+typedef struct tar_cache_stats
+{
+    uint64_t hits;       /* read_file calls served from the cache */
+    uint64_t misses;     /* read_file calls that had to go to the archive */
+    uint64_t evictions;  /* members dropped to stay under the byte budget */
+    size_t entries;      /* members currently cached */
+    size_t bytes;        /* bytes currently charged against the budget */
+} tar_cache_stats_t;
+
+typedef struct tar_index_stats
+{
+    size_t entries;      /* headers indexed */
+    size_t nodes;        /* trie nodes, including the root and directories without a header */
+    size_t components;   /* distinct path components */
+    size_t bytes;        /* memory used by the index */
+} tar_index_stats_t;
+
 /**
  * Checks whether the archive is valid.
  *
@@ -124,7 +150,7 @@ int is_symlink(int tar_fd, char *path);
  *
  * @param tar_fd A file descriptor pointing to the start of a valid tar archive file.
  * @param path A path to an entry in the archive. If the entry is a symlink, it must be resolved to its linked-to entry.
- * @param entries An array of char arrays, each one is long enough to contain a tar entry path.
+ * @param entries An array of char arrays, each one is long enough to contain a tar entry path (TAR_PATH_SIZE).
  * @param no_entries An in-out argument.
  *                   The caller set it to the number of entries in `entries`.
  *                   The callee set it to the number of entries listed.
@@ -154,4 +180,109 @@ int list(int tar_fd, char *path, char **entries, size_t *no_entries);
  */
 ssize_t read_file(int tar_fd, char *path, size_t offset, uint8_t *dest, size_t *len);
 
+/**
+ * Enables a content cache in front of read_file() for the given archive.
+ *
+ * The cache is a sharded LRU keyed by the resolved entry (symlinks are followed before caching).
+ * The entry a symlink resolves to is remembered too, so that reading through it again skips the lookup.
+ * Only members of at most `max_member_size` bytes are admitted, and the memory used by the cached
+ * members never exceeds `budget` bytes. Once enabled, read_file() on this archive no longer moves
+ * the file offset of `tar_fd` and can be called from several threads at once.
+ *
+ * The budget is split evenly between TAR_CACHE_SHARDS shards and a member must fit in one of them,
+ * so `max_member_size` plus a few hundred bytes of bookkeeping must not exceed budget / TAR_CACHE_SHARDS.
+ * Call tar_cache_disable() before closing tar_fd: read_file() trusts the cache of a descriptor number,
+ * whatever file it refers to, until tar_cache_disable() or tar_cache_enable() is called on it.
+ *
+ * @param tar_fd A file descriptor pointing to the start of a valid tar archive file.
+ * @param budget The maximum number of bytes the cache may hold.
+ * @param max_member_size The size of the largest member that may be cached.
+ *
+ * @return zero if the cache was enabled,
+ *         -1 if tar_fd is out of range, a cache is already enabled for it, max_member_size does not fit
+ *         in one shard of the budget or memory could not be allocated.
+ */
+int tar_cache_enable(int tar_fd, size_t budget, size_t max_member_size);
+
+/**
+ * Disables the content cache of the given archive and frees its memory.
+ * Must not be called while other threads are still reading from the archive.
+ *
+ * @param tar_fd A file descriptor with a cache enabled by tar_cache_enable().
+ */
+void tar_cache_disable(int tar_fd);
+
+/**
+ * Reads the counters of the content cache of the given archive.
+ *
+ * @param tar_fd A file descriptor with a cache enabled by tar_cache_enable().
+ * @param stats A destination structure for the counters.
+ *
+ * @return zero if the counters were written to stats,
+ *         -1 if no cache is enabled for tar_fd.
+ */
+int tar_cache_stats(int tar_fd, tar_cache_stats_t *stats);
+
+/**
+ * Builds an index of the paths of the archive.
+ *
+ * Once built, exists(), is_dir(), is_file(), is_symlink(), tar_typeflag() and list() look paths
+ * up in the index instead of scanning the archive, and read_file() only reads the headers it needs. They match
+ * paths exactly against the header names, as the scans do.
+ * The archive must not change while the index is in use. Call tar_index_free() before closing
+ * tar_fd: the library trusts the index of a descriptor number, whatever file it refers to, until
+ * tar_index_free() or tar_index_build() is called on it.
+ *
+ * @param tar_fd A file descriptor pointing to the start of a valid tar archive file.
+ *
+ * @return the number of entries indexed,
+ *         -1 if tar_fd is out of range, an index is already built for it, the archive is bigger
+ *         than 2 TiB or memory could not be allocated.
+ */
+int tar_index_build(int tar_fd);
+
+/**
+ * Frees the index of the given archive, the library goes back to scanning it.
+ *
+ * @param tar_fd A file descriptor with an index built by tar_index_build().
+ */
+void tar_index_free(int tar_fd);
+
+/**
+ * Reads the size of the index of the given archive.
+ *
+ * @param tar_fd A file descriptor with an index built by tar_index_build().
+ * @param stats A destination structure for the figures.
+ *
+ * @return zero if the figures were written to stats,
+ *         -1 if no index is built for tar_fd.
+ */
+int tar_index_stats(int tar_fd, tar_index_stats_t *stats);
+
+/**
+ * Finds where the content of a file is stored in the archive, without reading it.
+ * Lets a caller read the file itself, e.g. with pread() on the archive or on a copy of tar_fd.
+ *
+ * @param tar_fd A file descriptor pointing to the start of a valid tar archive file.
+ * @param path A path to an entry in the archive. If the entry is a symlink, it must be resolved to its linked-to entry.
+ * @param data_offset Set to the position of the first byte of the file in the archive.
+ * @param size Set to the size of the file.
+ *
+ * @return zero if the file was found,
+ *         -1 if no entry at the given path exists in the archive or the entry is not a file.
+ */
+int tar_locate(int tar_fd, char *path, off_t *data_offset, size_t *size);
+
+/**
+ * Gives the type of an entry in the archive, with a single lookup where exists(), is_dir(),
+ * is_file() and is_symlink() would need one each.
+ *
+ * @param tar_fd A file descriptor pointing to the start of a valid tar archive file.
+ * @param path A path to an entry in the archive.
+ *
+ * @return the typeflag of the header of the entry (REGTYPE, AREGTYPE, DIRTYPE, SYMTYPE...),
+ *         -1 if no entry at the given path exists in the archive.
+ */
+int tar_typeflag(int tar_fd, char *path);
+
 #endif
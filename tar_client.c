@@ -0,0 +1,397 @@
+#define _GNU_SOURCE
+#include "tar_client.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <errno.h>
+
+#define STAT_WINDOW 128     // requests sent by tarc_stat_many() before reading their replies
+
+typedef struct connection
+{
+    int archive_fd;         // descriptor of the archive, opened by the client and passed to the daemon
+    uint32_t next_id;
+    int broken;             // set on a transport or protocol error, the stream can no longer be trusted
+} connection_t;
+
+static connection_t *connections[TAR_MAX_HANDLES];
+
+static connection_t *connection_of(int tar_fd)
+{
+    if (tar_fd < 0 || tar_fd >= TAR_MAX_HANDLES)
+        return NULL;
+    return connections[tar_fd];
+}
+
+/**
+ * Private method
+ * Writes the whole buffer, retrying on short writes
+ */
+static int write_full(int fd, const void *buffer, size_t len)
+{
+    const char *bytes = buffer;
+    while (len > 0)
+    {
+        ssize_t written = send(fd, bytes, len, MSG_NOSIGNAL);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return -1;
+        bytes += written;
+        len -= written;
+    }
+    return 0;
+}
+
+/**
+ * Private method
+ * Reads exactly len bytes
+ */
+static int read_full(int fd, void *buffer, size_t len)
+{
+    char *bytes = buffer;
+    while (len > 0)
+    {
+        ssize_t got = read(fd, bytes, len);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            return -1;
+        bytes += got;
+        len -= got;
+    }
+    return 0;
+}
+
+/**
+ * Private method
+ * Appends a request to buffer, returns its length or -1 if the path is too long
+ */
+static ssize_t encode_request(char *buffer, uint32_t id, uint8_t op, const char *path, uint64_t arg)
+{
+    size_t path_len = path ? strlen(path) : 0;
+    if (path_len > TAR_PROTOCOL_MAX_PATH)
+        return -1;
+    tar_request_t request = {.id = id, .op = op, .path_len = path_len, .arg = arg};
+    memcpy(buffer, &request, sizeof(tar_request_t));
+    if (path_len > 0)
+        memcpy(buffer + sizeof(tar_request_t), path, path_len);
+    return sizeof(tar_request_t) + path_len;
+}
+
+/**
+ * Private method
+ * Shuts the connection down after an error that leaves part of a reply unread,
+ * every later call fails instead of reading the wrong reply
+ */
+static int fail(int tar_fd, connection_t *connection)
+{
+    connection->broken = 1;
+    shutdown(tar_fd, SHUT_RDWR);
+    return TARC_EDAEMON;
+}
+
+/**
+ * Private method
+ * Sends one request and waits for its reply, the body (if any) is returned in a malloc'ed buffer.
+ * Returns TARC_EDAEMON if the daemon could not be reached or answered something else
+ */
+static int call(int tar_fd, uint8_t op, const char *path, uint64_t arg, tar_reply_t *reply, char **body)
+{
+    connection_t *connection = connection_of(tar_fd);
+    if (connection == NULL || connection->broken)
+        return TARC_EDAEMON;
+    char buffer[sizeof(tar_request_t) + TAR_PROTOCOL_MAX_PATH];
+    ssize_t len = encode_request(buffer, connection->next_id, op, path, arg);
+    if (len < 0)
+    {
+        // No entry has such a path, answer as the daemon does for paths longer than a header name
+        memset(reply, 0, sizeof(tar_reply_t));
+        reply->status = op == TAR_OP_LOCATE ? -1 : 0;
+        if (body != NULL)
+            *body = NULL;
+        return 0;
+    }
+    uint32_t id = connection->next_id++;
+    if (write_full(tar_fd, buffer, len) != 0 || read_full(tar_fd, reply, sizeof(tar_reply_t)) != 0 || reply->id != id)
+        return fail(tar_fd, connection);
+    if (reply->body_len > 0)
+    {
+        char *received = malloc(reply->body_len);
+        if (received == NULL || read_full(tar_fd, received, reply->body_len) != 0)
+        {
+            free(received);
+            return fail(tar_fd, connection);
+        }
+        if (body != NULL)
+            *body = received;
+        else
+            free(received);
+    }
+    else if (body != NULL)
+        *body = NULL;
+    return 0;
+}
+
+/**
+ * Connects to a daemon and asks it to serve an archive.
+ *
+ * @param socket_path The path of the Unix domain socket the daemon listens on.
+ * @param archive The path of the tar archive to serve.
+ *
+ * @return a connection to use as tar_fd with the other functions,
+ *         -1 if the archive could not be opened for reading, the daemon could not be reached
+ *         or does not serve the archive.
+ */
+int tarc_open(const char *socket_path, const char *archive)
+{
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(struct sockaddr_un));
+    address.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(address.sun_path))
+        return -1;
+    strcpy(address.sun_path, socket_path);
+
+    // Opening the archive is what proves to the daemon that this user may read it
+    int archive_fd = open(archive, O_RDONLY | O_CLOEXEC);
+    if (archive_fd == -1)
+        return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+    {
+        close(archive_fd);
+        return -1;
+    }
+    if (fd >= TAR_MAX_HANDLES || connect(fd, (struct sockaddr *)&address, sizeof(struct sockaddr_un)) != 0)
+        goto error;
+
+    // The descriptor travels with the request
+    tar_request_t request = {.id = 0, .op = TAR_OP_OPEN};
+    char control[CMSG_SPACE(sizeof(int))];
+    memset(control, 0, sizeof(control));
+    struct iovec iov = {.iov_base = &request, .iov_len = sizeof(tar_request_t)};
+    struct msghdr message = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = control, .msg_controllen = sizeof(control)};
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &archive_fd, sizeof(int));
+    ssize_t sent;
+    do
+        sent = sendmsg(fd, &message, MSG_NOSIGNAL);
+    while (sent < 0 && errno == EINTR);
+    tar_reply_t reply;
+    if (sent != sizeof(tar_request_t) || read_full(fd, &reply, sizeof(tar_reply_t)) != 0
+        || reply.id != 0 || reply.status != 0 || reply.body_len != 0)
+        goto error;
+
+    connection_t *connection = calloc(1, sizeof(connection_t));
+    if (connection == NULL)
+        goto error;
+    connection->archive_fd = archive_fd;
+    connection->next_id = 1;
+    connections[fd] = connection;
+    return fd;
+
+error:
+    close(archive_fd);
+    close(fd);
+    return -1;
+}
+
+/**
+ * Closes a connection returned by tarc_open().
+ *
+ * @param tar_fd A connection returned by tarc_open().
+ */
+void tarc_close(int tar_fd)
+{
+    connection_t *connection = connection_of(tar_fd);
+    if (connection == NULL)
+        return;
+    connections[tar_fd] = NULL;
+    close(connection->archive_fd);
+    free(connection);
+    close(tar_fd);
+}
+
+/**
+ * Tells whether the daemon failed on a connection.
+ *
+ * @param tar_fd A connection returned by tarc_open().
+ *
+ * @return zero if the connection is usable,
+ *         TARC_EDAEMON if it is not a connection or the daemon failed on it.
+ */
+int tarc_error(int tar_fd)
+{
+    connection_t *connection = connection_of(tar_fd);
+    return connection == NULL || connection->broken ? TARC_EDAEMON : 0;
+}
+
+/**
+ * Same as check_archive() on the archive served by the connection.
+ * Returns TARC_EDAEMON if the daemon could not be reached.
+ */
+int tarc_check_archive(int tar_fd)
+{
+    tar_reply_t reply;
+    if (call(tar_fd, TAR_OP_CHECK, NULL, 0, &reply, NULL) != 0)
+        return TARC_EDAEMON;
+    return reply.status;
+}
+
+/**
+ * Private method
+ * Tests TAR_STAT_* bits of an entry, zero if the daemon could not be reached
+ */
+static int stat_entry(int tar_fd, char *path, int bit)
+{
+    tar_reply_t reply;
+    if (call(tar_fd, TAR_OP_STAT, path, 0, &reply, NULL) != 0)
+        return 0;
+    return (reply.status & bit) != 0;
+}
+
+/**
+ * Same as exists() on the archive served by the connection.
+ * Returns zero if the daemon could not be reached, see tarc_error().
+ */
+int tarc_exists(int tar_fd, char *path)
+{
+    return stat_entry(tar_fd, path, TAR_STAT_EXISTS);
+}
+
+/**
+ * Same as is_dir() on the archive served by the connection.
+ * Returns zero if the daemon could not be reached, see tarc_error().
+ */
+int tarc_is_dir(int tar_fd, char *path)
+{
+    return stat_entry(tar_fd, path, TAR_STAT_DIR);
+}
+
+/**
+ * Same as is_file() on the archive served by the connection.
+ * Returns zero if the daemon could not be reached, see tarc_error().
+ */
+int tarc_is_file(int tar_fd, char *path)
+{
+    return stat_entry(tar_fd, path, TAR_STAT_FILE);
+}
+
+/**
+ * Same as is_symlink() on the archive served by the connection.
+ * Returns zero if the daemon could not be reached, see tarc_error().
+ */
+int tarc_is_symlink(int tar_fd, char *path)
+{
+    return stat_entry(tar_fd, path, TAR_STAT_SYMLINK);
+}
+
+/**
+ * Same as list() on the archive served by the connection.
+ * Returns zero if the daemon could not be reached, see tarc_error().
+ */
+int tarc_list(int tar_fd, char *path, char **entries, size_t *no_entries)
+{
+    tar_reply_t reply;
+    char *body;
+    if (call(tar_fd, TAR_OP_LIST, path, *no_entries, &reply, &body) != 0)
+    {
+        *no_entries = 0;
+        return 0;
+    }
+    size_t counter = 0;
+    char *entry = body;
+    char *end = body + reply.body_len;
+    for (; counter < reply.count && counter < *no_entries && entry < end; counter++)
+    {
+        size_t entry_len = strnlen(entry, end - entry);
+        if (entry_len >= TAR_PATH_SIZE)
+            entry_len = TAR_PATH_SIZE - 1;
+        memcpy(entries[counter], entry, entry_len);
+        entries[counter][entry_len] = '\0';
+        entry += strnlen(entry, end - entry) + 1;
+    }
+    free(body);
+    if (reply.status != 0)
+        *no_entries = counter;
+    return reply.status;
+}
+
+/**
+ * Same as read_file() on the archive served by the connection.
+ * The content is read directly from the archive, it does not go through the daemon.
+ * Returns TARC_EDAEMON if the daemon could not be reached.
+ */
+ssize_t tarc_read_file(int tar_fd, char *path, size_t offset, uint8_t *dest, size_t *len)
+{
+    tar_reply_t reply;
+    if (call(tar_fd, TAR_OP_LOCATE, path, 0, &reply, NULL) != 0)
+        return TARC_EDAEMON;
+    if (reply.status != 0)
+        return -1;
+    if (offset > reply.size)
+        return -2;
+    size_t readable = reply.size - offset < *len ? reply.size - offset : *len;
+    ssize_t got = pread(connections[tar_fd]->archive_fd, dest, readable, reply.data_offset + offset);
+    *len = got > 0 ? got : 0;
+    return reply.size - offset - *len;
+}
+
+/**
+ * Looks up several entries at once, sending the requests without waiting for each reply.
+ *
+ * @param tar_fd A connection returned by tarc_open().
+ * @param paths The paths of the entries to look up.
+ * @param count The number of paths.
+ * @param types Set to the TAR_STAT_* bits of each entry, zero if it does not exist.
+ *
+ * @return zero if every entry was looked up,
+ *         -1 if a path is too long for the protocol or memory ran out,
+ *         TARC_EDAEMON if the daemon could not be reached.
+ */
+int tarc_stat_many(int tar_fd, char **paths, size_t count, int *types)
+{
+    connection_t *connection = connection_of(tar_fd);
+    if (connection == NULL || connection->broken)
+        return TARC_EDAEMON;
+    char *buffer = malloc(STAT_WINDOW * (sizeof(tar_request_t) + TAR_PROTOCOL_MAX_PATH));
+    if (buffer == NULL)
+        return -1;
+    // Send a window of requests at once, then read its replies, so that neither side fills its socket buffer
+    for (size_t first = 0; first < count; first += STAT_WINDOW)
+    {
+        size_t window = count - first < STAT_WINDOW ? count - first : STAT_WINDOW;
+        uint32_t first_id = connection->next_id;
+        size_t len = 0;
+        for (size_t i = 0; i < window; i++)
+        {
+            ssize_t encoded = encode_request(buffer + len, first_id + i, TAR_OP_STAT, paths[first + i], 0);
+            if (encoded < 0)
+            {
+                free(buffer);
+                return -1;
+            }
+            len += encoded;
+        }
+        connection->next_id += window;
+        if (write_full(tar_fd, buffer, len) != 0)
+        {
+            free(buffer);
+            return fail(tar_fd, connection);
+        }
+        for (size_t i = 0; i < window; i++)
+        {
+            tar_reply_t reply;
+            if (read_full(tar_fd, &reply, sizeof(tar_reply_t)) != 0 || reply.id != first_id + i || reply.body_len != 0)
+            {
+                free(buffer);
+                return fail(tar_fd, connection);
+            }
+            types[first + i] = reply.status;
+        }
+    }
+    free(buffer);
+    return 0;
+}
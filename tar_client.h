@@ -0,0 +1,101 @@
+#ifndef TAR_CLIENT_H
+#define TAR_CLIENT_H
+
+#include "lib_tar.h"
+#include "tar_protocol.h"
+
+/**
+ * Client of tar_daemon.
+ *
+ * The functions mirror lib_tar.h, the tar_fd they take is a connection returned by tarc_open().
+ * The daemon keeps the archive open and indexed, so a process only pays for connecting to it.
+ *
+ * The daemon fails when it cannot be reached or sends a reply that does not match the request.
+ * The connection is then shut down and later calls fail the same way until it is closed with
+ * tarc_close(). tarc_check_archive(), tarc_read_file() and tarc_stat_many() return TARC_EDAEMON.
+ * tarc_exists(), tarc_is_dir(), tarc_is_file(), tarc_is_symlink() and tarc_list() return zero,
+ * as for a missing entry, and tarc_error() tells the two apart.
+ */
+
+#define TARC_EDAEMON -4
+
+/**
+ * Connects to a daemon and asks it to serve an archive.
+ *
+ * @param socket_path The path of the Unix domain socket the daemon listens on.
+ * @param archive The path of the tar archive to serve.
+ *
+ * @return a connection to use as tar_fd with the other functions,
+ *         -1 if the archive could not be opened for reading, the daemon could not be reached
+ *         or does not serve the archive.
+ */
+int tarc_open(const char *socket_path, const char *archive);
+
+/**
+ * Closes a connection returned by tarc_open().
+ *
+ * @param tar_fd A connection returned by tarc_open().
+ */
+void tarc_close(int tar_fd);
+
+/**
+ * Tells whether the daemon failed on a connection.
+ *
+ * @param tar_fd A connection returned by tarc_open().
+ *
+ * @return zero if the connection is usable,
+ *         TARC_EDAEMON if it is not a connection or the daemon failed on it.
+ */
+int tarc_error(int tar_fd);
+
+/**
+ * Same as check_archive() on the archive served by the connection.
+ */
+int tarc_check_archive(int tar_fd);
+
+/**
+ * Same as exists() on the archive served by the connection.
+ */
+int tarc_exists(int tar_fd, char *path);
+
+/**
+ * Same as is_dir() on the archive served by the connection.
+ */
+int tarc_is_dir(int tar_fd, char *path);
+
+/**
+ * Same as is_file() on the archive served by the connection.
+ */
+int tarc_is_file(int tar_fd, char *path);
+
+/**
+ * Same as is_symlink() on the archive served by the connection.
+ */
+int tarc_is_symlink(int tar_fd, char *path);
+
+/**
+ * Same as list() on the archive served by the connection.
+ */
+int tarc_list(int tar_fd, char *path, char **entries, size_t *no_entries);
+
+/**
+ * Same as read_file() on the archive served by the connection.
+ * The content is read directly from the archive, it does not go through the daemon.
+ */
+ssize_t tarc_read_file(int tar_fd, char *path, size_t offset, uint8_t *dest, size_t *len);
+
+/**
+ * Looks up several entries at once, sending the requests without waiting for each reply.
+ *
+ * @param tar_fd A connection returned by tarc_open().
+ * @param paths The paths of the entries to look up.
+ * @param count The number of paths.
+ * @param types Set to the TAR_STAT_* bits of each entry, zero if it does not exist.
+ *
+ * @return zero if every entry was looked up,
+ *         -1 if a path is too long for the protocol or memory ran out,
+ *         TARC_EDAEMON if the daemon could not be reached.
+ */
+int tarc_stat_many(int tar_fd, char **paths, size_t count, int *types);
+
+#endif
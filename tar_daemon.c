@@ -0,0 +1,474 @@
+#define _GNU_SOURCE
+#include "lib_tar.h"
+#include "tar_protocol.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <errno.h>
+#include <signal.h>
+
+/**
+ * Serves lib_tar lookups over a Unix domain socket.
+ * Usage: ./tar_daemon socket_path archive [archive ...]
+ *
+ * Only the archives given on the command line are served. They are opened, checked and indexed
+ * before the socket starts listening, then shared by every connection. A client proves it may
+ * read an archive by opening it itself and passing the descriptor, the kernel has then checked
+ * the permissions. The daemon matches it against the served archives by device and inode and
+ * never hands out its own descriptors. The socket is created with mode 0660, so the owner and
+ * the group of the daemon can connect. Requests are handled in order on a single thread, so
+ * lib_tar never sees two calls on the same archive at once.
+ */
+
+#define MAX_ARCHIVES    64
+#define MAX_CONNECTIONS 256
+#define SOCKET_MODE     0660
+#define FIRST_ENTRIES   64          // entries asked to list() first, doubled while the directory has more
+#define MAX_PENDING     (1 << 20)   // stop reading from a client that does not read its replies
+#define MAX_PASSED_FDS  16          // descriptors taken from one recvmsg(), the extra ones are closed
+
+typedef struct archive
+{
+    dev_t dev;                      // identity of the file, matched against the descriptors clients pass
+    ino_t ino;
+    int fd;
+    int check;                      // check_archive() at startup
+} archive_t;
+
+typedef struct connection
+{
+    int fd;
+    int archive;                    // index in archives, -1 until TAR_OP_OPEN
+    int passed_fd;                  // descriptor sent by the client for TAR_OP_OPEN, -1 if none
+    int eof;                        // the client shut down its side, replies are still sent
+    char *in, *out;
+    size_t in_len, in_capacity;
+    size_t out_len, out_sent, out_capacity;
+} connection_t;
+
+static archive_t archives[MAX_ARCHIVES];
+static int no_archives = 0;
+static connection_t connections[MAX_CONNECTIONS];
+static int no_connections = 0;
+
+/**
+ * Opens, checks and indexes an archive given on the command line, returns -1 on error
+ */
+static int load_archive(const char *path)
+{
+    if (no_archives == MAX_ARCHIVES)
+        return -1;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return -1;
+    struct stat st;
+    int check = fstat(fd, &st) == 0 ? check_archive(fd) : -1;
+    if (check < 0 || tar_index_build(fd) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    archive_t *archive = &archives[no_archives];
+    archive->dev = st.st_dev;
+    archive->ino = st.st_ino;
+    archive->fd = fd;
+    archive->check = check;
+    printf("Serving %s (%d entries)\n", path, check);
+    return no_archives++;
+}
+
+/**
+ * Returns the index in archives of the archive a client passed a descriptor of, -1 if it is not
+ * served or the descriptor was not opened for reading
+ */
+static int find_archive(int passed_fd)
+{
+    struct stat st;
+    int flags = fcntl(passed_fd, F_GETFL);
+    if (flags == -1 || (flags & O_PATH) || (flags & O_ACCMODE) == O_WRONLY || fstat(passed_fd, &st) != 0)
+        return -1;
+    for (int i = 0; i < no_archives; i++)
+    {
+        if (archives[i].dev == st.st_dev && archives[i].ino == st.st_ino)
+            return i;
+    }
+    return -1;
+}
+
+static int reserve(char **buffer, size_t *capacity, size_t needed)
+{
+    if (needed <= *capacity)
+        return 0;
+    size_t wanted = *capacity ? *capacity : 4096;
+    while (wanted < needed)
+        wanted *= 2;
+    char *bigger = realloc(*buffer, wanted);
+    if (bigger == NULL)
+        return -1;
+    *buffer = bigger;
+    *capacity = wanted;
+    return 0;
+}
+
+/**
+ * Queues a reply and its body on the connection
+ */
+static int queue_reply(connection_t *connection, tar_reply_t *reply, const char *body)
+{
+    size_t len = sizeof(tar_reply_t) + reply->body_len;
+    if (reserve(&connection->out, &connection->out_capacity, connection->out_len + len) != 0)
+        return -1;
+    memcpy(connection->out + connection->out_len, reply, sizeof(tar_reply_t));
+    if (reply->body_len > 0)
+        memcpy(connection->out + connection->out_len + sizeof(tar_reply_t), body, reply->body_len);
+    connection->out_len += len;
+    return 0;
+}
+
+/**
+ * Binds the connection to the archive the client passed a descriptor of with TAR_OP_OPEN
+ */
+static int reply_open(connection_t *connection, tar_request_t *request)
+{
+    tar_reply_t reply;
+    memset(&reply, 0, sizeof(tar_reply_t));
+    reply.id = request->id;
+    // Only the first request may bind the connection, nothing is queued before it
+    int archive = -1;
+    if (connection->archive == -1 && connection->out_len == 0 && connection->passed_fd != -1)
+        archive = find_archive(connection->passed_fd);
+    // The descriptor was only a proof, the archive is read through the daemon's own
+    if (connection->passed_fd != -1)
+        close(connection->passed_fd);
+    connection->passed_fd = -1;
+    if (archive == -1)
+        reply.status = -1;
+    else
+        connection->archive = archive;
+    return queue_reply(connection, &reply, NULL);
+}
+
+/**
+ * list() into a packed body of NUL-terminated paths, the buffers grow with the directory
+ * rather than with what the client asked for
+ */
+static int reply_list(int fd, char *path, size_t max_entries, tar_reply_t *reply, char **body)
+{
+    size_t capacity = max_entries < FIRST_ENTRIES ? max_entries : FIRST_ENTRIES;
+    char *storage = NULL;
+    char **entries = NULL;
+    size_t no_entries;
+    while (1)
+    {
+        free(storage);
+        free(entries);
+        storage = malloc(capacity * TAR_PATH_SIZE + 1);
+        entries = malloc((capacity + 1) * sizeof(char *));
+        if (storage == NULL || entries == NULL)
+        {
+            free(storage);
+            free(entries);
+            return -1;
+        }
+        for (size_t i = 0; i < capacity; i++)
+            entries[i] = storage + i * TAR_PATH_SIZE;
+        no_entries = capacity;
+        reply->status = list(fd, path, entries, &no_entries);
+        if (reply->status == 0 || no_entries < capacity || capacity == max_entries)
+            break;
+        capacity = capacity * 2 < max_entries ? capacity * 2 : max_entries;
+    }
+    if (reply->status != 0)
+    {
+        // Pack the paths one after the other in place
+        size_t len = 0;
+        for (size_t i = 0; i < no_entries; i++)
+        {
+            size_t entry_len = strnlen(entries[i], TAR_PATH_SIZE - 1) + 1;
+            memmove(storage + len, entries[i], entry_len - 1);
+            storage[len + entry_len - 1] = '\0';
+            len += entry_len;
+        }
+        reply->count = no_entries;
+        reply->body_len = len;
+        *body = storage;
+    }
+    else
+        free(storage);
+    free(entries);
+    return 0;
+}
+
+/**
+ * Runs one request against the archive of the connection and queues its reply
+ */
+static int handle_request(connection_t *connection, tar_request_t *request, char *path)
+{
+    if (request->op == TAR_OP_OPEN)
+        return reply_open(connection, request);
+
+    tar_reply_t reply;
+    memset(&reply, 0, sizeof(tar_reply_t));
+    reply.id = request->id;
+    if (connection->archive == -1)
+    {
+        reply.status = -1;
+        return queue_reply(connection, &reply, NULL);
+    }
+    int fd = archives[connection->archive].fd;
+    // No entry has a name longer than a header name field or cut by a NUL, do not let such paths reach lib_tar
+    int unmatched = request->path_len >= TAR_PATH_SIZE || memchr(path, '\0', request->path_len) != NULL;
+    char *body = NULL;
+    switch (request->op)
+    {
+    case TAR_OP_CHECK:
+        reply.status = archives[connection->archive].check;
+        break;
+    case TAR_OP_STAT:
+    {
+        int typeflag = unmatched ? -1 : tar_typeflag(fd, path);
+        if (typeflag != -1)
+        {
+            reply.status = TAR_STAT_EXISTS;
+            reply.status |= typeflag == DIRTYPE ? TAR_STAT_DIR : 0;
+            reply.status |= typeflag == REGTYPE || typeflag == AREGTYPE ? TAR_STAT_FILE : 0;
+            reply.status |= typeflag == SYMTYPE ? TAR_STAT_SYMLINK : 0;
+        }
+        break;
+    }
+    case TAR_OP_LIST:
+    {
+        size_t max_entries = request->arg < TAR_PROTOCOL_MAX_ENTRIES ? request->arg : TAR_PROTOCOL_MAX_ENTRIES;
+        if (!unmatched && reply_list(fd, path, max_entries, &reply, &body) != 0)
+            return -1;
+        break;
+    }
+    case TAR_OP_LOCATE:
+    {
+        off_t data_offset = 0;
+        size_t size = 0;
+        reply.status = unmatched ? -1 : tar_locate(fd, path, &data_offset, &size);
+        reply.data_offset = data_offset;
+        reply.size = size;
+        break;
+    }
+    default:
+        reply.status = -1;
+    }
+    int queued = queue_reply(connection, &reply, body);
+    free(body);
+    return queued;
+}
+
+/**
+ * Handles the complete requests received on the connection until MAX_PENDING bytes of replies
+ * are queued, the rest waits for the client to read them. Returns -1 to drop the connection
+ */
+static int handle_input(connection_t *connection)
+{
+    size_t consumed = 0;
+    char path[TAR_PROTOCOL_MAX_PATH + 1];
+    while (connection->out_len < MAX_PENDING && connection->in_len - consumed >= sizeof(tar_request_t))
+    {
+        tar_request_t request;
+        memcpy(&request, connection->in + consumed, sizeof(tar_request_t));
+        if (request.path_len > TAR_PROTOCOL_MAX_PATH)
+            return -1;
+        if (connection->in_len - consumed < sizeof(tar_request_t) + request.path_len)
+            break;
+        memcpy(path, connection->in + consumed + sizeof(tar_request_t), request.path_len);
+        path[request.path_len] = '\0';
+        consumed += sizeof(tar_request_t) + request.path_len;
+        if (handle_request(connection, &request, path) != 0)
+            return -1;
+    }
+    memmove(connection->in, connection->in + consumed, connection->in_len - consumed);
+    connection->in_len -= consumed;
+    return 0;
+}
+
+/**
+ * Sends as much of the queued replies as the socket takes, returns -1 to drop the connection
+ */
+static int flush_output(connection_t *connection)
+{
+    while (connection->out_sent < connection->out_len)
+    {
+        ssize_t sent = send(connection->fd, connection->out + connection->out_sent,
+                            connection->out_len - connection->out_sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return 0;
+        if (sent <= 0)
+            return -1;
+        connection->out_sent += sent;
+    }
+    connection->out_len = connection->out_sent = 0;
+    return 0;
+}
+
+/**
+ * Returns whether a whole request is waiting in the input buffer
+ */
+static int has_request(connection_t *connection)
+{
+    tar_request_t request;
+    if (connection->in_len < sizeof(tar_request_t))
+        return 0;
+    memcpy(&request, connection->in, sizeof(tar_request_t));
+    return connection->in_len >= sizeof(tar_request_t) + request.path_len;
+}
+
+/**
+ * Answers the buffered requests and sends the replies. The requests held back at MAX_PENDING
+ * are handled as soon as their replies fit, a client that pipelined them may wait for them
+ * without sending anything else. Returns -1 to drop the connection
+ */
+static int process(connection_t *connection)
+{
+    do
+    {
+        if (handle_input(connection) != 0 || flush_output(connection) != 0)
+            return -1;
+    } while (connection->out_len < MAX_PENDING && has_request(connection));
+    // A client that shut down its side is dropped once it got all its replies
+    return connection->eof && connection->out_len == 0 ? -1 : 0;
+}
+
+/**
+ * Reads what the client sent and answers it, returns -1 to drop the connection
+ */
+static int serve(connection_t *connection)
+{
+    if (reserve(&connection->in, &connection->in_capacity, connection->in_len + 65536) != 0)
+        return -1;
+    char control[CMSG_SPACE(MAX_PASSED_FDS * sizeof(int))];
+    struct iovec iov = {.iov_base = connection->in + connection->in_len, .iov_len = 65536};
+    struct msghdr message = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = control, .msg_controllen = sizeof(control)};
+    ssize_t got = recvmsg(connection->fd, &message, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+    if (got < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+        return 0;
+    if (got < 0)
+        return -1;
+    // Keep the first descriptor passed before TAR_OP_OPEN is handled, close anything else
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message); cmsg != NULL; cmsg = CMSG_NXTHDR(&message, cmsg))
+    {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+        size_t no_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (size_t i = 0; i < no_fds; i++)
+        {
+            int passed_fd;
+            memcpy(&passed_fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+            if (connection->archive == -1 && connection->passed_fd == -1)
+                connection->passed_fd = passed_fd;
+            else
+                close(passed_fd);
+        }
+    }
+    if (got == 0)
+        connection->eof = 1;
+    connection->in_len += got;
+    return process(connection);
+}
+
+static void drop(int i)
+{
+    if (connections[i].passed_fd != -1)
+        close(connections[i].passed_fd);
+    close(connections[i].fd);
+    free(connections[i].in);
+    free(connections[i].out);
+    connections[i] = connections[--no_connections];
+}
+
+static void accept_connection(int listener)
+{
+    int fd = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+    if (fd == -1)
+        return;
+    connection_t *connection = &connections[no_connections];
+    memset(connection, 0, sizeof(connection_t));
+    connection->fd = fd;
+    connection->archive = -1;
+    connection->passed_fd = -1;
+    no_connections++;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        printf("Usage: %s socket_path archive [archive ...]\n", argv[0]);
+        return -1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    for (int i = 2; i < argc; i++)
+    {
+        if (load_archive(argv[i]) == -1)
+            printf("Could not serve %s\n", argv[i]);
+    }
+    if (no_archives == 0)
+        return -1;
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(struct sockaddr_un));
+    address.sun_family = AF_UNIX;
+    if (strlen(argv[1]) >= sizeof(address.sun_path))
+    {
+        printf("Socket path too long: %s\n", argv[1]);
+        return -1;
+    }
+    strcpy(address.sun_path, argv[1]);
+    unlink(argv[1]);
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    // Never let the socket exist with looser permissions than SOCKET_MODE
+    mode_t mask = umask(0777 & ~SOCKET_MODE);
+    int bound = listener != -1 && bind(listener, (struct sockaddr *)&address, sizeof(struct sockaddr_un)) == 0;
+    umask(mask);
+    if (!bound || chmod(argv[1], SOCKET_MODE) != 0 || listen(listener, 128) != 0)
+    {
+        perror("listen(socket_path)");
+        return -1;
+    }
+    printf("Listening on %s\n", argv[1]);
+
+    struct pollfd fds[MAX_CONNECTIONS + 1];
+    while (1)
+    {
+        fds[0].fd = listener;
+        fds[0].events = no_connections < MAX_CONNECTIONS ? POLLIN : 0;
+        for (int i = 0; i < no_connections; i++)
+        {
+            fds[i + 1].fd = connections[i].fd;
+            fds[i + 1].events = connections[i].out_len < MAX_PENDING && !connections[i].eof ? POLLIN : 0;
+            fds[i + 1].events |= connections[i].out_len > 0 ? POLLOUT : 0;
+        }
+        if (poll(fds, no_connections + 1, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            return -1;
+        }
+        // Walk backwards, drop() moves the last connection into the freed slot
+        int polled = no_connections;
+        for (int i = polled - 1; i >= 0; i--)
+        {
+            short revents = fds[i + 1].revents;
+            int failed = 0;
+            if (revents & POLLOUT)
+                failed = process(&connections[i]) != 0;
+            if (!failed && (revents & POLLIN))
+                failed = serve(&connections[i]) != 0;
+            else if (!failed && (revents & (POLLHUP | POLLERR | POLLNVAL)))
+                failed = 1;
+            if (failed)
+                drop(i);
+        }
+        if (fds[0].revents & POLLIN)
+            accept_connection(listener);
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef TAR_PROTOCOL_H
+#define TAR_PROTOCOL_H
+
+#include <stdint.h>
+
+/**
+ * Wire format between tar_daemon and tar_client, over a Unix domain stream socket.
+ *
+ * Both ends run on the same host, so fields are in host byte order.
+ * A client sends requests without waiting for the replies (pipelining), the daemon answers
+ * them in the order they were sent and echoes their id.
+ *
+ * The first request of a connection must be TAR_OP_OPEN, any other request before it fails
+ * with status -1, and so does a second TAR_OP_OPEN. The client opens the archive for reading
+ * itself and sends the descriptor along with the request (SCM_RIGHTS), the daemon serves it if
+ * it is the same file as one of the archives named on its command line. File contents are read
+ * by the client with pread() on its own descriptor instead of being copied through the socket.
+ *
+ * Paths longer than a header name (TAR_PATH_SIZE - 1) or containing a NUL never match an entry,
+ * the daemon answers them without looking them up.
+ */
+
+#define TAR_OP_OPEN     1   /* no path, a descriptor of the archive to serve comes with the request */
+#define TAR_OP_CHECK    2   /* status: check_archive() */
+#define TAR_OP_STAT     3   /* status: TAR_STAT_* bits of the entry at path */
+#define TAR_OP_LIST     4   /* arg: max entries; status: list(), count: entries, body: NUL-terminated paths */
+#define TAR_OP_LOCATE   5   /* status: tar_locate(), data_offset and size of the file at path */
+
+/* Bits of the status of TAR_OP_STAT */
+#define TAR_STAT_EXISTS  1
+#define TAR_STAT_DIR     2
+#define TAR_STAT_FILE    4
+#define TAR_STAT_SYMLINK 8
+
+#define TAR_PROTOCOL_MAX_PATH    4096   /* longest path accepted in a request */
+#define TAR_PROTOCOL_MAX_ENTRIES 65536  /* most entries returned by one TAR_OP_LIST */
+
+typedef struct tar_request
+{                                 /* byte offset */
+    uint32_t id;                  /*  0 */
+    uint8_t op;                   /*  4 */
+    uint8_t padding;              /*  5 */
+    uint16_t path_len;            /*  6 bytes of path following the request, no NUL */
+    uint64_t arg;                 /*  8 */
+} tar_request_t;
+
+typedef struct tar_reply
+{                                 /* byte offset */
+    uint32_t id;                  /*  0 */
+    int32_t status;               /*  4 */
+    uint64_t data_offset;         /*  8 */
+    uint64_t size;                /* 16 */
+    uint32_t count;               /* 24 */
+    uint32_t body_len;            /* 28 bytes of body following the reply */
+} tar_reply_t;
+
+#endif
@@ -1,4 +1,9 @@
 #include "lib_tar.h"
+#include "tar_client.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <signal.h>
 
 /**
  * You are free to use this file to write tests for your implementation
@@ -53,6 +58,14 @@ int main(int argc, char **argv) {
     printf("It should return 1 : ");
     printf("returned %d\n", exist);
 
+    exist = exists(fd, "/test/");
+    printf("It should return 0 : ");
+    printf("returned %d\n", exist);
+
+    exist = exists(fd, "test//test.txt");
+    printf("It should return 0 : ");
+    printf("returned %d\n", exist);
+
     /**
      * @brief is_dir UT
      */
@@ -102,7 +115,7 @@ int main(int argc, char **argv) {
     char ** entries = (char **) malloc(*no_entries*sizeof(char*));
     for(int i=0; i<*no_entries; i++)
     {
-        entries[i] = (char*) malloc(sizeof(char*));
+        entries[i] = (char*) malloc(256*sizeof(char));
     }
 
     int listed = list(fd, "test/", entries, no_entries);
@@ -158,7 +171,7 @@ int main(int argc, char **argv) {
     // Preparing resources
     size_t * len = (size_t*) malloc(sizeof(size_t));
     *len = 5;
-    uint8_t * dest = (uint8_t*) malloc(*len*sizeof(uint8_t));
+    uint8_t * dest = (uint8_t*) calloc(64, sizeof(uint8_t));
 
     int readed = read_file(fd, "test/test.txt", 3, dest, len);
     printf("Content readed should return 'st' : ");
@@ -224,5 +237,357 @@ int main(int argc, char **argv) {
     free(len);
     free(dest);
 
+    /**
+     * @brief read_file with content cache
+     */
+    printf("\nDescribe: read_file with content cache\n");
+
+    // Preparing resources
+    size_t cached_len = 4;
+    uint8_t cached_dest[5] = {0};
+    tar_cache_stats_t stats;
+
+    int enabled = tar_cache_enable(fd, 4096, 64);
+    printf("It should return 0 : ");
+    printf("returned %d\n", enabled);
+
+    enabled = tar_cache_enable(fd, 4096, 64);
+    printf("It should return -1 : ");
+    printf("returned %d\n", enabled);
+
+    readed = read_file(fd, "test/test.txt", 0, cached_dest, &cached_len);
+    printf("Content readed should return 'Je t' : ");
+    printf("'%s'\n", (char*) cached_dest);
+    printf("It should return 33 : ");
+    printf("returned %d\n", readed);
+
+    cached_len = 4;
+    readed = read_file(fd, "test/test.txt", 35, cached_dest, &cached_len);
+    printf("Bytes readed should return 2 : ");
+    printf("%zu\n", cached_len);
+    printf("It should return 0 : ");
+    printf("returned %d\n", readed);
+
+    cached_len = 4;
+    readed = read_file(fd, "test_link", 0, cached_dest, &cached_len);
+    printf("Content readed should return 'Je t' : ");
+    printf("'%s'\n", (char*) cached_dest);
+    printf("It should return 33 : ");
+    printf("returned %d\n", readed);
+
+    readed = read_file(fd, "test/test.txt", 56, cached_dest, &cached_len);
+    printf("It should return -2 : ");
+    printf("returned %d\n", readed);
+
+    readed = read_file(fd, "test/", 0, cached_dest, &cached_len);
+    printf("It should return -1 : ");
+    printf("returned %d\n", readed);
+
+    tar_cache_stats(fd, &stats);
+    printf("Hits should return 3 : ");
+    printf("%llu\n", (unsigned long long) stats.hits);
+    printf("Misses should return 1 : ");
+    printf("%llu\n", (unsigned long long) stats.misses);
+    printf("Entries should return 1 : ");
+    printf("%zu\n", stats.entries);
+
+    // Freeing resources
+    tar_cache_disable(fd);
+
+    enabled = tar_cache_enable(fd, 1 << 20, 64 << 10);
+    printf("Member larger than a shard, it should return -1 : ");
+    printf("returned %d\n", enabled);
+
+    // The smallest budget accepted for members up to 37 bytes, a shard then holds one of them
+    size_t budget = 16 * 37;
+    while (tar_cache_enable(fd, budget, 37) != 0)
+    {
+        budget += 16;
+    }
+    // Both members land in the same shard
+    cached_len = 4;
+    read_file(fd, "test/test.txt", 0, cached_dest, &cached_len);
+    cached_len = 4;
+    read_file(fd, "test/test2/test3.txt", 0, cached_dest, &cached_len);
+    tar_cache_stats(fd, &stats);
+    printf("Evictions should return 1 : ");
+    printf("%llu\n", (unsigned long long) stats.evictions);
+    cached_len = 4;
+    readed = read_file(fd, "test/test.txt", 0, cached_dest, &cached_len);
+    tar_cache_stats(fd, &stats);
+    printf("It should return 33 : ");
+    printf("returned %d\n", readed);
+    printf("Evicted member read again, misses should return 3 : ");
+    printf("%llu\n", (unsigned long long) stats.misses);
+    tar_cache_disable(fd);
+
+    // A cache left behind on a closed descriptor is dropped when the number is enabled again
+    int reused_fd = open(argv[1], O_RDONLY);
+    tar_cache_enable(reused_fd, 4096, 64);
+    cached_len = 4;
+    read_file(reused_fd, "test/test.txt", 0, cached_dest, &cached_len);
+    close(reused_fd);
+    int other_fd = open("tests.c", O_RDONLY);
+    printf("Same descriptor should return 1 : ");
+    printf("%d\n", other_fd == reused_fd);
+    enabled = tar_cache_enable(other_fd, 4096, 64);
+    printf("It should return 0 : ");
+    printf("returned %d\n", enabled);
+    cached_len = 4;
+    readed = read_file(other_fd, "test/test.txt", 0, cached_dest, &cached_len);
+    printf("Not in this file, it should return -1 : ");
+    printf("returned %d\n", readed);
+    tar_cache_disable(other_fd);
+    close(other_fd);
+
+    /**
+     * @brief path index
+     */
+    printf("\nDescribe: path index\n");
+
+    int indexed = tar_index_build(fd);
+    printf("It should return 11 : ");
+    printf("returned %d\n", indexed);
+
+    indexed = tar_index_build(fd);
+    printf("It should return -1 : ");
+    printf("returned %d\n", indexed);
+
+    exist = exists(fd, "test/test2/test3.txt");
+    printf("It should return 1 : ");
+    printf("returned %d\n", exist);
+
+    exist = exists(fd, "test");
+    printf("It should return 0 : ");
+    printf("returned %d\n", exist);
+
+    // Paths must match the header names exactly, like without an index
+    exist = exists(fd, "/test/");
+    printf("It should return 0 : ");
+    printf("returned %d\n", exist);
+
+    exist = exists(fd, "test//test.txt");
+    printf("It should return 0 : ");
+    printf("returned %d\n", exist);
+
+    dir = is_dir(fd, "test//");
+    printf("It should return 0 : ");
+    printf("returned %d\n", dir);
+
+    dir = is_dir(fd, "test/test2/");
+    printf("It should return 1 : ");
+    printf("returned %d\n", dir);
+
+    file = is_file(fd, "test_link");
+    printf("It should return 0 : ");
+    printf("returned %d\n", file);
+
+    link = is_symlink(fd, "test_dir");
+    printf("It should return 1 : ");
+    printf("returned %d\n", link);
+
+    // Preparing resources
+    size_t index_no_entries = 4;
+    char * index_entries[4];
+    for(int i=0; i<4; i++)
+    {
+        index_entries[i] = (char*) malloc(256*sizeof(char));
+    }
+
+    char long_path[805] = "test";
+    memset(long_path + 4, '/', 800);
+    long_path[804] = '\0';
+    listed = list(fd, long_path, index_entries, &index_no_entries);
+    printf("It should return 0 : ");
+    printf("returned %d\n", listed);
+
+    listed = list(fd, "test_dir", index_entries, &index_no_entries);
+    printf("List should return [ test/test2/  test/test2.txt  test/test.txt ] : [");
+    for(int i=0; i<index_no_entries; i++)
+    {
+        printf(" %s ", index_entries[i]);
+    }
+    printf("]\n");
+    printf("It should return 1 : ");
+    printf("returned %d\n", listed);
+
+    cached_len = 4;
+    readed = read_file(fd, "test_link", 3, cached_dest, &cached_len);
+    printf("Content readed should return 'tent' : ");
+    printf("'%s'\n", (char*) cached_dest);
+    printf("It should return 30 : ");
+    printf("returned %d\n", readed);
+
+    tar_index_stats_t index_stats;
+    tar_index_stats(fd, &index_stats);
+    printf("Entries should return 11 : ");
+    printf("%zu\n", index_stats.entries);
+
+    // Freeing resources
+    for(int i=0; i<4; i++)
+    {
+        free(index_entries[i]);
+    }
+    tar_index_free(fd);
+
+    // An index left behind on a closed descriptor is dropped when the number is indexed again
+    reused_fd = open(argv[1], O_RDONLY);
+    tar_index_build(reused_fd);
+    close(reused_fd);
+    other_fd = open("tests.c", O_RDONLY);
+    tar_index_build(other_fd);
+    exist = exists(other_fd, "test/test.txt");
+    printf("Same descriptor should return 1 : ");
+    printf("%d\n", other_fd == reused_fd);
+    printf("Not in this file, it should return 0 : ");
+    printf("returned %d\n", exist);
+    tar_index_free(other_fd);
+    close(other_fd);
+
+    /**
+     * @brief tar_daemon and tar_client
+     */
+    printf("\nDescribe: tar_daemon\n");
+
+    char socket_path[64];
+    snprintf(socket_path, sizeof(socket_path), "/tmp/lib_tar_tests_%d.sock", (int) getpid());
+    pid_t daemon = fork();
+    if (daemon == 0) {
+        int null_fd = open("/dev/null", O_WRONLY);
+        dup2(null_fd, STDOUT_FILENO);
+        execl("./tar_daemon", "tar_daemon", socket_path, argv[1], (char*) NULL);
+        _exit(127);
+    }
+
+    int tar_client = -1;
+    for (int i = 0; i < 500 && tar_client == -1; i++) {
+        tar_client = tarc_open(socket_path, argv[1]);
+        if (tar_client == -1) usleep(10000);
+    }
+    printf("It should return 1 : ");
+    printf("%d\n", tar_client >= 0);
+
+    int second_client = tarc_open(socket_path, argv[1]);
+    printf("Second connection, it should return 1 : ");
+    printf("%d\n", second_client >= 0);
+    tarc_close(second_client);
+
+    int unserved = tarc_open(socket_path, "tests.c");
+    printf("Archive not served, it should return -1 : ");
+    printf("returned %d\n", unserved);
+
+    printf("It should return 11 : ");
+    printf("returned %d\n", tarc_check_archive(tar_client));
+
+    printf("It should return 1 : ");
+    printf("returned %d\n", tarc_exists(tar_client, "test/test2/test3.txt"));
+
+    printf("It should return 0 : ");
+    printf("returned %d\n", tarc_exists(tar_client, "/test/"));
+
+    printf("It should return 0 : ");
+    printf("returned %d\n", tarc_exists(tar_client, long_path));
+
+    printf("It should return 1 : ");
+    printf("returned %d\n", tarc_is_dir(tar_client, "test/test2/"));
+
+    index_no_entries = 4;
+    for(int i=0; i<4; i++)
+    {
+        index_entries[i] = (char*) malloc(256*sizeof(char));
+    }
+    listed = tarc_list(tar_client, "test_dir", index_entries, &index_no_entries);
+    printf("List should return [ test/test2/  test/test2.txt  test/test.txt ] : [");
+    for(int i=0; i<index_no_entries; i++)
+    {
+        printf(" %s ", index_entries[i]);
+    }
+    printf("]\n");
+    printf("It should return 1 : ");
+    printf("returned %d\n", listed);
+
+    index_no_entries = 4;
+    listed = tarc_list(tar_client, long_path, index_entries, &index_no_entries);
+    printf("It should return 0 : ");
+    printf("returned %d\n", listed);
+
+    cached_len = 4;
+    readed = tarc_read_file(tar_client, "test_link", 3, cached_dest, &cached_len);
+    printf("Content readed should return 'tent' : ");
+    printf("'%s'\n", (char*) cached_dest);
+    printf("It should return 30 : ");
+    printf("returned %d\n", readed);
+
+    // More paths than one window of pipelined requests
+    char * stat_paths[300];
+    int stat_types[300];
+    for(int i=0; i<300; i++)
+    {
+        stat_paths[i] = i % 3 == 0 ? "test/" : i % 3 == 1 ? "test/test.txt" : "test_link";
+    }
+    stat_paths[299] = "nope";
+    int statted = tarc_stat_many(tar_client, stat_paths, 300, stat_types);
+    printf("Types should return 3 5 9 0 : ");
+    printf("%d %d %d %d\n", stat_types[0], stat_types[1], stat_types[2], stat_types[299]);
+    printf("It should return 0 : ");
+    printf("returned %d\n", statted);
+
+    printf("It should return 0 : ");
+    printf("returned %d\n", tarc_error(tar_client));
+
+    printf("Not a connection, it should return 0 -4 : ");
+    printf("%d %d\n", tarc_exists(-1, "test/"), tarc_error(-1));
+
+    // Requests before and after TAR_OP_OPEN on a raw connection
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(struct sockaddr_un));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socket_path);
+    int raw = socket(AF_UNIX, SOCK_STREAM, 0);
+    connect(raw, (struct sockaddr*) &address, sizeof(struct sockaddr_un));
+    int statuses[6];
+    uint8_t ops[6] = {TAR_OP_STAT, TAR_OP_OPEN, TAR_OP_OPEN, TAR_OP_OPEN, TAR_OP_STAT, TAR_OP_STAT};
+    char * raw_paths[6] = {"test/", "", "", "", "test/\0junk", "test/"};
+    uint16_t raw_lens[6] = {5, 0, 0, 0, 10, 5};
+    int pass_archive[6] = {0, 0, 1, 1, 0, 0};
+    int archive_fd = open(argv[1], O_RDONLY);
+    for(int i=0; i<6; i++)
+    {
+        tar_request_t request = {.id = i, .op = ops[i], .path_len = raw_lens[i]};
+        char control[CMSG_SPACE(sizeof(int))];
+        memset(control, 0, sizeof(control));
+        struct iovec iov = {.iov_base = &request, .iov_len = sizeof(tar_request_t)};
+        struct msghdr message = {.msg_iov = &iov, .msg_iovlen = 1};
+        if (pass_archive[i]) {
+            message.msg_control = control;
+            message.msg_controllen = sizeof(control);
+            struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_RIGHTS;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+            memcpy(CMSG_DATA(cmsg), &archive_fd, sizeof(int));
+        }
+        sendmsg(raw, &message, 0);
+        write(raw, raw_paths[i], raw_lens[i]);
+        tar_reply_t reply;
+        memset(&reply, 0, sizeof(tar_reply_t));
+        recv(raw, &reply, sizeof(tar_reply_t), MSG_WAITALL);
+        statuses[i] = reply.status;
+    }
+    printf("Stat before open, open without descriptor, open, open again, NUL in path, stat should return -1 -1 0 -1 0 3 : ");
+    printf("%d %d %d %d %d %d\n", statuses[0], statuses[1], statuses[2], statuses[3], statuses[4], statuses[5]);
+    close(archive_fd);
+    close(raw);
+
+    // Freeing resources
+    for(int i=0; i<4; i++)
+    {
+        free(index_entries[i]);
+    }
+    tarc_close(tar_client);
+    kill(daemon, SIGTERM);
+    waitpid(daemon, NULL, 0);
+    unlink(socket_path);
+
     return 0;
 }
\ No newline at end of file